@@ -1,514 +1,512 @@
-/*
-Copyright 2019 Cirque Corporation
-
-Licensed under the Apache License, Version 2.0 (the "License");
-you may not use this file except in compliance with the License.
-You may obtain a copy of the License at
-
-    http://www.apache.org/licenses/LICENSE-2.0
-
-Unless required by applicable law or agreed to in writing, software
-distributed under the License is distributed on an "AS IS" BASIS,
-WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-See the License for the specific language governing permissions and
-limitations under the License.
-*/
-
-#include "CirqueBootloaderCollection.h"
-#include <stdexcept>
-
-#include <sys/ioctl.h>
-#include <fcntl.h>
-#include <unistd.h>
-
-CirqueBootloaderCollection::CirqueBootloaderCollection(string& device_path, int report_id)
-{
-	this->hid_report_id = report_id;
-
-	this->fd = open(device_path.c_str(), O_RDWR);
-
-	if(this->fd == -1)
-	{
-		printf( "Could not open path: %s\n", device_path.c_str() );
-	}
-}
-
-CirqueBootloaderCollection::~CirqueBootloaderCollection()
-{
-	if (this->fd != -1) close(this->fd);
-}
-
-bool CirqueBootloaderCollection::SanityCheck()
-{
-	// Check if the device is in bootloader mode.
-	CirqueBootloaderStatus status;
-	if( GetStatus( status ) != BL_SUCCESS || status.Sentinel != 0x5AC3 && status.Sentinel != 0x6D49 && status.Sentinel != 0x426C ) return false;
-
-	// Sanity check
-	vector<uint8_t> base_addr;
-	this->ExtendedRead(0x20000800, 4, base_addr);
-	if(
-		(base_addr.size() < 1) ||
-		(base_addr[0] != 0x00) ||
-		(base_addr[1] != 0x08) ||
-		(base_addr[2] != 0x00) ||
-		(base_addr[3] != 0x20)
-	)
-	{
-		return false;
-	}
-
-	// Record the endian-ness of the part
-	vector<uint8_t> is_big_endian;
-	this->ExtendedRead(0x20000824, 1, is_big_endian);
-	if( is_big_endian.size() < 1 ) return false;
-
-	this->IS_BIG_ENDIAN = ((is_big_endian[0] & 0x01) == 0) ? 0 : 1;
-	return true;
-}
-
-int CirqueBootloaderCollection::GenFeatureIOCTL(int length, int get_not_set)
-{
-	int x = (1 + 2) << 30;
-	x += (length << 16);
-	x += (0x48) << 8;
-
-	if(get_not_set != 0)
-	{
-		x += 0x07;
-	}
-	else
-	{
-		x += 0x06;
-	}
-
-	return x;
-}
-
-int CirqueBootloaderCollection::GenGETFeatureIOCTL(int length)
-{
-	return this->GenFeatureIOCTL(length, 1);
-}
-
-int CirqueBootloaderCollection::GenSETFeatureIOCTL(int length)
-{
-	return this->GenFeatureIOCTL(length, 0);
-}
-
-void CirqueBootloaderCollection::AppendU32toBuffer(uint32_t value, vector<uint8_t> &data)
-{
-	data.push_back((value >> 0) & 0xFF);
-	data.push_back((value >> 8) & 0xFF);
-	data.push_back((value >> 16) & 0xFF);
-	data.push_back((value >> 24) & 0xFF);
-}
-
-void CirqueBootloaderCollection::AppendU16toBuffer(uint16_t value, vector<uint8_t> &data)
-{
-	data.push_back((value >> 0) & 0xFF);
-	data.push_back((value >> 8) & 0xFF);
-}
-
-uint32_t CirqueBootloaderCollection::GetU32FromBuffer(uint8_t * buffer)
-{
-	uint32_t val = buffer[0] + (buffer[1] << 8) + (buffer[2] << 16) + (buffer[3] << 24);
-	return val;
-}
-
-uint16_t CirqueBootloaderCollection::GetU16FromBuffer(uint8_t * buffer)
-{
-	uint16_t val = buffer[0] + (buffer[1] << 8);
-	return val;
-}
-
-void CirqueBootloaderCollection::PadBuffer(vector<uint8_t> &data)
-{
-	size_t needed_length = this->report_length - data.size();
-
-	for(size_t i = 0; i < needed_length; ++i)
-	{
-		data.push_back(0);
-	}
-}
-
-void CirqueBootloaderCollection::ParseReadDataFromStatus(vector<uint8_t> &status_data, uint32_t &addr, uint16_t &length, vector<uint8_t> &return_buffer)
-{
-	size_t response_start_index = 0;
-	addr = 0;
-	length = 0;
-	return_buffer.clear();
-
-	// Check version number
-	if (status_data[3] >= 8)
-	{
-		response_start_index = 9;
-	}
-	else
-	{
-		response_start_index = 6;
-	}
-
-	// Get address and length bytes
-	addr = this->GetU32FromBuffer(&status_data[response_start_index]);
-	length = this->GetU16FromBuffer(&status_data[response_start_index + 4]);
-
-	// Check length
-	if ( length > ( this->report_length - response_start_index - 6 ) )
-	{
-		printf( "CirqueBootloaderCollection::ParseReadDataFromStatus: bad length: %d\n", length );
-		return;
-	}
-
-	// Create buffer of just the applicable data
-	for(size_t i = response_start_index + 6; i < response_start_index + 6 + length; ++i)
-	{
-		return_buffer.push_back(status_data[i]);
-	}
-}
-
-uint16_t CirqueBootloaderCollection::Fletcher_16(uint8_t *dataPtr, size_t bytes)
-{
-	uint16_t sum1 = 0xff;
-	uint16_t sum2 = 0xff;
-
-	while (bytes)
-	{
-		uint32_t tlen = bytes > 20 ? 20 : bytes;
-		bytes -= tlen;
-		do
-		{
-			sum2 += sum1 += *dataPtr++;
-		} while (--tlen);
-		sum1 = (sum1 & 0xff) + (sum1 >> 8);
-		sum2 = (sum2 & 0xff) + (sum2 >> 8);
-	}
-
-	// Second reduction step to reduce sums to 8 bits
-	sum1 = (sum1 & 0xff) + (sum1 >> 8);
-	sum2 = (sum2 & 0xff) + (sum2 >> 8);
-	return sum2 << 8 | sum1;
-}
-
-uint32_t CirqueBootloaderCollection::Fletcher_32(uint16_t *dataPtr, size_t bytes)
-{
-	uint32_t sum1 = 0xffff;
-	uint32_t sum2 = 0xffff;
-	uint16_t data = 0;
-
-	while (bytes)
-	{
-		uint16_t tlen = bytes > 360 ? 360 : bytes;
-		bytes -= tlen;
-		do
-		{
-			data = *dataPtr++;
-			if (IS_BIG_ENDIAN) data = (data << 8) | (data >> 8);
-			sum2 += sum1 += data;
-		} while (tlen -= sizeof(uint16_t));
-		sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-		sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-	}
-
-	// Second reduction step to reduce sums to 16 bits
-	sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-	sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-	return sum2 << 16 | sum1;
-}
-
-int CirqueBootloaderCollection::BootloaderSetFeature(vector<uint8_t> &data)
-{
-	if (this->fd == -1) return 0;
-	int sent = 0;
-	int ioctl_value = this->GenSETFeatureIOCTL(this->report_length);
-	sent = ioctl(this->fd, ioctl_value, &data[0]);
-	return sent;
-}
-
-int CirqueBootloaderCollection::BootloaderGetFeature(vector<uint8_t> &data)
-{
-	if (this->fd == -1) return 0;
-	int received = 0;
-	int ioctl_value = this->GenGETFeatureIOCTL(this->report_length);
-	received = ioctl(this->fd, ioctl_value, &data[0]);
-	return received;
-}
-
-vector<uint8_t> CirqueBootloaderCollection::ExtendedRead(uint32_t addr, uint16_t length)
-{
-	vector<uint8_t> return_buffer;
-	this->ExtendedRead(addr, length, return_buffer);
-	return return_buffer;
-}
-
-void CirqueBootloaderCollection::ExtendedRead(uint32_t addr, uint16_t length, vector<uint8_t> &return_buffer)
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_READ_MEM);
-
-	this->AppendU32toBuffer(addr,buf);
-	this->AppendU16toBuffer(length,buf);
-	
-	this->report_length = buf.size();
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		printf( "CirqueBootloaderCollection::ExtendedRead: Sent bytes didn't equal correct number: %d\n", bytes_sent );
-		return;
-	}
-	
-	this->report_length = this->BL_REPORT_LENGTH;
-	this->PadBuffer(buf);
-
-	int bytes_received = this->BootloaderGetFeature(buf);
-	if(bytes_received != this->report_length)
-	{
-		printf( "CirqueBootloaderCollection::ExtendedRead: Received bytes didn't equal correct number: %d\n", bytes_received );
-		return;
-	}
-
-	this->ParseReadDataFromStatus(buf, addr, length, return_buffer);
-}
-
-void CirqueBootloaderCollection::ExtendedWrite(uint32_t addr, vector<uint8_t> &byte_array)
-{
-	uint16_t length = byte_array.size();
-
-	vector<uint8_t> buf;
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_WRITE_MEM);
-
-	this->AppendU32toBuffer(addr, buf);
-	this->AppendU16toBuffer(length, buf);
-	buf.insert(buf.end(), byte_array.begin(), byte_array.end());
-
-	uint16_t checksum = this->Fletcher_16(&buf[1], 1 + 4 + 2 + length);
-	this->AppendU16toBuffer(checksum, buf);
-
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		printf( "CirqueBootloaderCollection::ExtendedWrite: Bytes sent did not match: %d\n", bytes_sent );
-	}
-}
-
-int CirqueBootloaderCollection::GetStatus( CirqueBootloaderStatus& Status )
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	this->PadBuffer(buf);
-	
-	int bytes_received = this->BootloaderGetFeature(buf);
-	if(bytes_received != this->report_length)
-	{
-		return BL_FAILURE;
-	}
-
-	Status.Sentinel = (uint16_t)buf[2] << 8 | buf[1];
-
-	switch( Status.Sentinel )
-	{
-		case 0x5AC3:
-		case 0xC35A:
-		case 0x6C42: //'lB'
-		case 0x6D49: //'mI'
-		case 0x426C: //'Bl' for old firmware
-			break;
-		default:
-			return BL_READ_ERROR;
-	}
-
-	Status.Version = buf[3];
-	Status.LastError = (ErrorCodes)buf[4];
-	Status.Flags = buf[5];
-	Status.ImageLayout = (buf[5] & 0x01) != 0 ? Dual : Single;
-	Status.ActiveImage = (buf[5] & 0x06) == 0 ? None : ((buf[4] & 0x06) >> 1) == 0 ? One : Two;
-	Status.bBusy = (buf[5] & 0x08) != 0;
-	Status.bImageValid = (buf[5] & 0x10) != 0;
-	Status.bForce = (buf[5] & 0x20) != 0;
-
-	if( Status.Version >= 0x08 )
-	{
-		Status.AtomicWriteSize = buf[6];
-		Status.ByteWriteDelayUs = buf[7];
-		Status.RegionFormatDelayMsPer1K = buf[8];
-	}
-	else
-	{
-		Status.AtomicWriteSize = Status.ByteWriteDelayUs = Status.RegionFormatDelayMsPer1K = 0;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::Reset()
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_RESET);
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::Invoke()
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_INVOKE_BL);
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::FormatImage( uint8_t NumRegions, uint32_t EntryPointAddress, uint8_t I2CAddress, uint16_t HIDDescriptorAddr )
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_FORMAT_IMAGE);
-	buf.push_back(Single);
-	buf.push_back(NumRegions);
-
-	this->AppendU32toBuffer(EntryPointAddress, buf);
-	this->AppendU16toBuffer(HIDDescriptorAddr, buf);
-
-	buf.push_back(I2CAddress);
-	buf.push_back(this->hid_report_id);
-
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::FormatRegion( uint8_t RegionNumber, uint32_t RegionOffset, vector<uint8_t>& data )
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_FORMAT_REGION);
-	buf.push_back(RegionNumber);
-
-	this->AppendU32toBuffer(RegionOffset, buf);
-	this->AppendU32toBuffer(data.size(), buf);
-	this->AppendU32toBuffer(this->Fletcher_32((uint16_t*)&data[0], data.size()), buf);
-
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::WriteData( uint32_t WriteOffset, uint32_t NumBytes, vector<uint8_t>& data )
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_WRITE);
-
-	this->AppendU32toBuffer(WriteOffset, buf);
-	this->AppendU32toBuffer(NumBytes, buf);
-
-	buf.insert(buf.end(), data.begin(), data.end());
-
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::Flush()
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_FLUSH);
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::Validate( ValidationType Validation )
-{
-	vector<uint8_t> buf;
-
-	buf.push_back(this->hid_report_id);
-	buf.push_back(this->BL_CMD_VALIDATE);
-	buf.push_back(Validation);
-	this->PadBuffer(buf);
-
-	int bytes_sent = this->BootloaderSetFeature(buf);
-	if(bytes_sent != this->report_length)
-	{
-		return BL_WRITE_ERROR;
-	}
-
-	return BL_SUCCESS;
-}
-
-int CirqueBootloaderCollection::GetVersionInfo(uint16_t &vid, uint16_t &pid, uint16_t &ver, uint32_t &rev)
-{
-	vector<uint8_t> bytes;
-
-	this->ExtendedRead(0x2000080A, 0x20000824 - 0x2000080A + 1, bytes);
-	if( bytes.size() < 0x20000824 - 0x2000080A + 1) return BL_READ_ERROR;
-	uint8_t is_big_endian = bytes[0x20000824 - 0x2000080A];
-
-	if((is_big_endian & 0x01) == 0)
-	{
-		vid = bytes[0] | ((bytes[1] << 8) & 0xFF00);
-		pid = bytes[2] | ((bytes[3] << 8) & 0xFF00);
-		ver = bytes[4] | ((bytes[5] << 8) & 0xFF00);
-		rev = bytes[6] | ((bytes[7] << 8) & 0x0000FF00) | ((bytes[8] << 16) & 0x00FF0000) | ((bytes[9] << 24) & 0xFF000000);
-	}
-	else
-	{
-		vid = bytes[1] | ((bytes[0] << 8) & 0xFF00);
-		pid = bytes[3] | ((bytes[2] << 8) & 0xFF00);
-		ver = bytes[5] | ((bytes[4] << 8) & 0xFF00);
-		rev = bytes[8] | ((bytes[8] << 8) & 0x0000FF00) | ((bytes[7] << 16) & 0x00FF0000) | ((bytes[6] << 24) & 0xFF000000);
-	}
-
-	return BL_SUCCESS;
-}
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueBootloaderCollection.h"
+#include "CirqueTiming.h"
+#include <stdexcept>
+#include <cstring>
+#include <unistd.h>
+
+CirqueBootloaderCollection::CirqueBootloaderCollection(string& device_path, int report_id) : encoder(report_id)
+{
+	this->hid_report_id = report_id;
+	this->transport = CirqueHidTransport::Open(device_path);
+	this->owns_transport = true;
+}
+
+CirqueBootloaderCollection::CirqueBootloaderCollection(CirqueHidTransport *hid_transport, int report_id) : encoder(report_id)
+{
+	this->hid_report_id = report_id;
+	this->transport = hid_transport;
+	this->owns_transport = false;
+}
+
+CirqueBootloaderCollection::~CirqueBootloaderCollection()
+{
+	if (this->owns_transport) delete this->transport;
+}
+
+bool CirqueBootloaderCollection::SanityCheck()
+{
+	// Check if the device is in bootloader mode.
+	CirqueBootloaderStatus status;
+	if( GetStatus( status ) != BL_SUCCESS || status.Sentinel != 0x5AC3 && status.Sentinel != 0x6D49 && status.Sentinel != 0x426C ) return false;
+
+	// Sanity check
+	vector<uint8_t> base_addr;
+	this->ExtendedRead(0x20000800, 4, base_addr);
+	if(
+		(base_addr.size() < 1) ||
+		(base_addr[0] != 0x00) ||
+		(base_addr[1] != 0x08) ||
+		(base_addr[2] != 0x00) ||
+		(base_addr[3] != 0x20)
+	)
+	{
+		return false;
+	}
+
+	// Record the endian-ness of the part
+	vector<uint8_t> is_big_endian;
+	this->ExtendedRead(0x20000824, 1, is_big_endian);
+	if( is_big_endian.size() < 1 ) return false;
+
+	this->IS_BIG_ENDIAN = ((is_big_endian[0] & 0x01) == 0) ? 0 : 1;
+	return true;
+}
+
+uint32_t CirqueBootloaderCollection::GetU32FromBuffer(uint8_t * buffer)
+{
+	uint32_t val = buffer[0] + (buffer[1] << 8) + (buffer[2] << 16) + (buffer[3] << 24);
+	return val;
+}
+
+uint16_t CirqueBootloaderCollection::GetU16FromBuffer(uint8_t * buffer)
+{
+	uint16_t val = buffer[0] + (buffer[1] << 8);
+	return val;
+}
+
+void CirqueBootloaderCollection::ParseReadDataFromStatus(uint8_t *status_data, uint32_t &addr, uint16_t &length, vector<uint8_t> &return_buffer)
+{
+	size_t response_start_index = 0;
+	addr = 0;
+	length = 0;
+	return_buffer.clear();
+
+	// Check version number
+	if (status_data[3] >= 8)
+	{
+		response_start_index = 9;
+	}
+	else
+	{
+		response_start_index = 6;
+	}
+
+	// Get address and length bytes
+	addr = this->GetU32FromBuffer(&status_data[response_start_index]);
+	length = this->GetU16FromBuffer(&status_data[response_start_index + 4]);
+
+	// Check length
+	if ( length > ( BL_REPORT_LENGTH - response_start_index - 6 ) )
+	{
+		printf( "CirqueBootloaderCollection::ParseReadDataFromStatus: bad length: %d\n", length );
+		return;
+	}
+
+	// Create buffer of just the applicable data
+	return_buffer.assign(&status_data[response_start_index + 6], &status_data[response_start_index + 6 + length]);
+}
+
+uint32_t CirqueBootloaderCollection::Fletcher_32(const uint8_t *dataPtr, size_t bytes, int big_endian)
+{
+	CirqueFletcher32 checksum(big_endian);
+	checksum.Add(dataPtr, bytes);
+	return checksum.Value();
+}
+
+void CirqueFletcher32::Word(uint8_t first, uint8_t second)
+{
+	sum2 += sum1 += big_endian ? (first << 8) | second : first | (second << 8);
+	if (++words == 180) Reduce();
+}
+
+void CirqueFletcher32::Reduce()
+{
+	sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+	sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+	words = 0;
+}
+
+// Reduces the sums every 180 words counted from the start of the data.
+void CirqueFletcher32::Add(const uint8_t *data, size_t bytes)
+{
+	if (pending >= 0 && bytes)
+	{
+		Word((uint8_t)pending, *data++);
+		bytes--;
+		pending = -1;
+	}
+
+	while (bytes >= 2)
+	{
+		size_t count = 180 - words;
+		if (count > bytes / 2) count = bytes / 2;
+		for (size_t i = 0; i < count; i++, data += 2)
+			sum2 += sum1 += big_endian ? (data[0] << 8) | data[1] : data[0] | (data[1] << 8);
+		bytes -= 2 * count;
+		words += count;
+		if (words == 180) Reduce();
+	}
+
+	if (bytes) pending = *data;
+}
+
+uint32_t CirqueFletcher32::Value() const
+{
+	// An odd trailing byte is summed as if followed by erased flash.
+	CirqueFletcher32 tail = *this;
+	if (tail.pending >= 0) tail.Word((uint8_t)tail.pending, 0xff);
+	if (tail.words) tail.Reduce();
+	tail.Reduce();
+	return tail.sum2 << 16 | tail.sum1;
+}
+
+int CirqueBootloaderCollection::BootloaderSetFeature(int length)
+{
+	// A command nobody waited for ends when the next one is sent.
+	this->CloseCommand(this->command_sent_us);
+
+	uint8_t command = this->encoder.Frame()[1];
+	uint64_t start = CirqueMonotonicUs();
+	int bytes_sent = this->transport->SetFeature(this->encoder.Frame(), length);
+	uint64_t end = CirqueMonotonicUs();
+
+	this->Stats.Record(STAT_SET_FEATURE, end - start, (bytes_sent > 0) ? bytes_sent : 0);
+	if (bytes_sent == length && command < STAT_SET_FEATURE)
+	{
+		this->open_command = command;
+		this->command_bytes = length;
+		this->command_start_us = start;
+		this->command_sent_us = end;
+	}
+	return bytes_sent;
+}
+
+int CirqueBootloaderCollection::BootloaderGetFeature(int length)
+{
+	uint64_t start = CirqueMonotonicUs();
+	int bytes_received = this->transport->GetFeature(this->encoder.Frame(), length);
+	uint64_t end = CirqueMonotonicUs();
+
+	this->Stats.Record(STAT_GET_FEATURE, end - start, (bytes_received > 0) ? bytes_received : 0);
+	if (this->open_command == STAT_READ_MEM) this->CloseCommand(end);
+	return bytes_received;
+}
+
+void CirqueBootloaderCollection::CloseCommand(uint64_t end_us)
+{
+	if (this->open_command < 0) return;
+
+	this->Stats.Record(this->open_command, end_us - this->command_start_us, this->command_bytes);
+	this->open_command = -1;
+}
+
+int CirqueBootloaderCollection::SendCommand(int length)
+{
+	if(length < 0) return BL_WRITE_ERROR;
+
+	int bytes_sent = this->BootloaderSetFeature(length);
+	if(bytes_sent != length)
+	{
+		return BL_WRITE_ERROR;
+	}
+
+	return BL_SUCCESS;
+}
+
+vector<uint8_t> CirqueBootloaderCollection::ExtendedRead(uint32_t addr, uint16_t length)
+{
+	vector<uint8_t> return_buffer;
+	this->ExtendedRead(addr, length, return_buffer);
+	return return_buffer;
+}
+
+void CirqueBootloaderCollection::ExtendedRead(uint32_t addr, uint16_t length, vector<uint8_t> &return_buffer)
+{
+	return_buffer.clear();
+
+	int request_length = this->encoder.ReadMem(addr, length);
+	int bytes_sent = this->BootloaderSetFeature(request_length);
+	if(bytes_sent != request_length)
+	{
+		printf( "CirqueBootloaderCollection::ExtendedRead: Sent bytes didn't equal correct number: %d\n", bytes_sent );
+		return;
+	}
+
+	int bytes_received = this->BootloaderGetFeature(this->encoder.Status());
+	if(bytes_received != BL_REPORT_LENGTH)
+	{
+		printf( "CirqueBootloaderCollection::ExtendedRead: Received bytes didn't equal correct number: %d\n", bytes_received );
+		return;
+	}
+
+	this->ParseReadDataFromStatus(this->encoder.Frame(), addr, length, return_buffer);
+}
+
+int CirqueBootloaderCollection::BulkRead(uint32_t addr, uint8_t *data, uint32_t length, uint32_t max_chunk)
+{
+	// Read in pieces of up to max_chunk bytes, or as many as a reply can
+	// hold, straight into the caller's buffer.
+	if (max_chunk == 0 || max_chunk > this->MaxReadPayload()) max_chunk = this->MaxReadPayload();
+	uint32_t done = 0;
+	while (done < length)
+	{
+		uint16_t count = (length - done > max_chunk) ? max_chunk : length - done;
+
+		int request_length = this->encoder.ReadMem(addr + done, count);
+		if (this->BootloaderSetFeature(request_length) != request_length) return BL_WRITE_ERROR;
+		if (this->BootloaderGetFeature(this->encoder.Status()) != BL_REPORT_LENGTH) return BL_READ_ERROR;
+
+		uint8_t *frame = this->encoder.Frame();
+		this->status_version = frame[3];
+		size_t response_start_index = (frame[3] >= 8) ? 9 : 6;
+		uint32_t reply_addr = this->GetU32FromBuffer(&frame[response_start_index]);
+		uint16_t reply_length = this->GetU16FromBuffer(&frame[response_start_index + 4]);
+		if (reply_addr != addr + done || reply_length != count)
+		{
+			printf( "CirqueBootloaderCollection::BulkRead: unexpected reply for 0x%08X: 0x%08X, %d bytes\n", addr + done, reply_addr, reply_length );
+			return BL_READ_ERROR;
+		}
+
+		memcpy(&data[done], &frame[response_start_index + 6], count);
+		done += count;
+	}
+
+	return BL_SUCCESS;
+}
+
+void CirqueBootloaderCollection::ExtendedWrite(uint32_t addr, vector<uint8_t> &byte_array)
+{
+	this->ExtendedWrite(addr, byte_array.data(), byte_array.size());
+}
+
+void CirqueBootloaderCollection::ExtendedWrite(uint32_t addr, const uint8_t *data, uint16_t length)
+{
+	int report_length = this->encoder.WriteMem(addr, data, length);
+	int bytes_sent = (report_length < 0) ? report_length : this->BootloaderSetFeature(report_length);
+	if(bytes_sent != report_length || report_length < 0)
+	{
+		printf( "CirqueBootloaderCollection::ExtendedWrite: Bytes sent did not match: %d\n", bytes_sent );
+	}
+}
+
+int CirqueBootloaderCollection::GetStatus( CirqueBootloaderStatus& Status )
+{
+	this->Stats.StatusPolls++;
+	int bytes_received = this->BootloaderGetFeature(this->encoder.Status());
+	if(bytes_received != BL_REPORT_LENGTH)
+	{
+		return BL_FAILURE;
+	}
+
+	uint8_t *buf = this->encoder.Frame();
+
+	Status.Sentinel = (uint16_t)buf[2] << 8 | buf[1];
+
+	switch( Status.Sentinel )
+	{
+		case 0x5AC3:
+		case 0xC35A:
+		case 0x6C42: //'lB'
+		case 0x6D49: //'mI'
+		case 0x426C: //'Bl' for old firmware
+			break;
+		default:
+			return BL_READ_ERROR;
+	}
+
+	Status.Version = buf[3];
+	this->status_version = Status.Version;
+	Status.LastError = (ErrorCodes)buf[4];
+	Status.Flags = buf[5];
+	Status.ImageLayout = (buf[5] & 0x01) != 0 ? Dual : Single;
+	Status.ActiveImage = (buf[5] & 0x06) == 0 ? None : ((buf[4] & 0x06) >> 1) == 0 ? One : Two;
+	Status.bBusy = (buf[5] & 0x08) != 0;
+	Status.bImageValid = (buf[5] & 0x10) != 0;
+	Status.bForce = (buf[5] & 0x20) != 0;
+
+	if( Status.Version >= 0x08 )
+	{
+		Status.AtomicWriteSize = buf[6];
+		Status.ByteWriteDelayUs = buf[7];
+		Status.RegionFormatDelayMsPer1K = buf[8];
+	}
+	else
+	{
+		Status.AtomicWriteSize = Status.ByteWriteDelayUs = Status.RegionFormatDelayMsPer1K = 0;
+	}
+
+	return BL_SUCCESS;
+}
+
+uint32_t CirqueBootloaderCollection::StartWait( uint32_t DelayUs, int Mode )
+{
+	this->wait_delay_us = DelayUs;
+	this->wait_backoff_us = BL_POLL_MIN_BACKOFF_US;
+	this->wait_error = NV_err_none;
+	this->wait_mode = Mode;
+
+	// DelayUs is the advertised worst case, so allow twice that before giving up.
+	this->wait_deadline_us = CirqueMonotonicUs() + 2 * (uint64_t)DelayUs + BL_POLL_MARGIN_US;
+
+	// Bootloaders before version 8 don't advertise their timing, so the
+	// busy flag isn't trusted and the full delay is used.
+	if( this->status_version < 0x08 ) return DelayUs;
+	return 0;
+}
+
+int CirqueBootloaderCollection::PollCompletion( CirqueBootloaderStatus& Status, uint32_t& NextPollUs )
+{
+	bool legacy = this->status_version < 0x08;
+	int retval = GetStatus( Status );
+	bool in_mode = this->wait_mode < 0 || ( retval == BL_SUCCESS && IsBootloader( Status.Sentinel ) == this->wait_mode );
+	if( legacy && in_mode )
+	{
+		this->CloseCommand( CirqueMonotonicUs() );
+		return retval;
+	}
+
+	// The device may not answer while it restarts, so failures count as busy.
+	if( retval == BL_SUCCESS && !legacy )
+	{
+		if( this->wait_error == NV_err_none ) this->wait_error = Status.LastError;
+		if( !Status.bBusy && in_mode )
+		{
+			// Report an error seen by any of the polls.
+			Status.LastError = this->wait_error;
+			this->CloseCommand( CirqueMonotonicUs() );
+			return BL_SUCCESS;
+		}
+	}
+
+	if( CirqueMonotonicUs() >= this->wait_deadline_us )
+	{
+		this->CloseCommand( CirqueMonotonicUs() );
+		if( retval == BL_SUCCESS && ( legacy || !Status.bBusy ) )
+		{
+			printf( "CirqueBootloaderCollection::WaitForCompletion: device still in %s mode after %d us\n", this->wait_mode ? "application" : "bootloader", 2 * this->wait_delay_us + BL_POLL_MARGIN_US );
+			return BL_MODE_TIMEOUT;
+		}
+		printf( "CirqueBootloaderCollection::WaitForCompletion: device still busy after %d us\n", 2 * this->wait_delay_us + BL_POLL_MARGIN_US );
+		return ( retval == BL_SUCCESS ) ? BL_BUSY_TIMEOUT : retval;
+	}
+
+	NextPollUs = this->wait_backoff_us;
+	this->wait_backoff_us = ( this->wait_backoff_us * 2 > BL_POLL_MAX_BACKOFF_US ) ? BL_POLL_MAX_BACKOFF_US : this->wait_backoff_us * 2;
+	return BL_IN_PROGRESS;
+}
+
+int CirqueBootloaderCollection::WaitForCompletion( uint32_t DelayUs, CirqueBootloaderStatus& Status )
+{
+	uint32_t next = StartWait( DelayUs );
+	int retval;
+
+	do
+	{
+		if( next )
+		{
+			usleep( next );
+			this->Stats.SleepUs += next;
+		}
+		retval = PollCompletion( Status, next );
+	} while( retval == BL_IN_PROGRESS );
+
+	return retval;
+}
+
+int CirqueBootloaderCollection::Reset()
+{
+	return this->SendCommand(this->encoder.Reset());
+}
+
+int CirqueBootloaderCollection::Invoke()
+{
+	return this->SendCommand(this->encoder.Invoke());
+}
+
+int CirqueBootloaderCollection::FormatImage( uint8_t NumRegions, uint32_t EntryPointAddress, uint8_t I2CAddress, uint16_t HIDDescriptorAddr )
+{
+	return this->SendCommand(this->encoder.FormatImage(Single, NumRegions, EntryPointAddress, HIDDescriptorAddr, I2CAddress));
+}
+
+int CirqueBootloaderCollection::FormatRegion( uint8_t RegionNumber, const CirqueImageRegion& region )
+{
+	// Binary firmware files carry the checksums, so the region needn't be read.
+	if (region.HasChecksums)
+		return this->SendCommand(this->encoder.FormatRegion(RegionNumber, region.Address, region.Size, region.Checksums[this->IS_BIG_ENDIAN ? 1 : 0]));
+	return this->FormatRegion(RegionNumber, region.Address, region.Data, region.Size);
+}
+
+int CirqueBootloaderCollection::FormatRegion( uint8_t RegionNumber, uint32_t RegionOffset, const uint8_t *data, uint32_t NumBytes )
+{
+	uint32_t checksum = Fletcher_32(data, NumBytes, this->IS_BIG_ENDIAN);
+	return this->SendCommand(this->encoder.FormatRegion(RegionNumber, RegionOffset, NumBytes, checksum));
+}
+
+int CirqueBootloaderCollection::WriteData( uint32_t WriteOffset, uint32_t NumBytes, vector<uint8_t>& data )
+{
+	return this->WriteData(WriteOffset, data.data(), NumBytes);
+}
+
+int CirqueBootloaderCollection::WriteData( uint32_t WriteOffset, const uint8_t *data, uint32_t NumBytes )
+{
+	return this->SendCommand(this->encoder.Write(WriteOffset, data, NumBytes));
+}
+
+int CirqueBootloaderCollection::Flush()
+{
+	return this->SendCommand(this->encoder.Flush());
+}
+
+int CirqueBootloaderCollection::Validate( ValidationType Validation )
+{
+	return this->SendCommand(this->encoder.Validate(Validation));
+}
+
+int CirqueBootloaderCollection::GetVersionInfo(uint16_t &vid, uint16_t &pid, uint16_t &ver, uint32_t &rev)
+{
+	vector<uint8_t> bytes;
+
+	this->ExtendedRead(0x2000080A, 0x20000824 - 0x2000080A + 1, bytes);
+	if( bytes.size() < 0x20000824 - 0x2000080A + 1) return BL_READ_ERROR;
+	uint8_t is_big_endian = bytes[0x20000824 - 0x2000080A];
+
+	if((is_big_endian & 0x01) == 0)
+	{
+		vid = bytes[0] | ((bytes[1] << 8) & 0xFF00);
+		pid = bytes[2] | ((bytes[3] << 8) & 0xFF00);
+		ver = bytes[4] | ((bytes[5] << 8) & 0xFF00);
+		rev = bytes[6] | ((bytes[7] << 8) & 0x0000FF00) | ((bytes[8] << 16) & 0x00FF0000) | ((bytes[9] << 24) & 0xFF000000);
+	}
+	else
+	{
+		vid = bytes[1] | ((bytes[0] << 8) & 0xFF00);
+		pid = bytes[3] | ((bytes[2] << 8) & 0xFF00);
+		ver = bytes[5] | ((bytes[4] << 8) & 0xFF00);
+		rev = bytes[9] | ((bytes[8] << 8) & 0x0000FF00) | ((bytes[7] << 16) & 0x00FF0000) | ((bytes[6] << 24) & 0xFF000000);
+	}
+
+	return BL_SUCCESS;
+}
+
+int IsBootloader(uint16_t sentinel)
+{
+	switch (sentinel)
+	{
+	case 0xC35A:
+	case 0x6C42: //'lB'
+		return 1;
+	case 0x5AC3:
+	case 0x6D49: //'mI'
+	case 0x426C: //'Bl' for old firmware
+		return 0;
+	default:
+		return -1;
+	}
+	return -1;
+}
@@ -1,143 +1,205 @@
-/*
-Copyright 2019 Cirque Corporation
-
-Licensed under the Apache License, Version 2.0 (the "License");
-you may not use this file except in compliance with the License.
-You may obtain a copy of the License at
-
-    http://www.apache.org/licenses/LICENSE-2.0
-
-Unless required by applicable law or agreed to in writing, software
-distributed under the License is distributed on an "AS IS" BASIS,
-WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-See the License for the specific language governing permissions and
-limitations under the License.
-*/
-
-#ifndef __CIRQUE_BOOTLOADER_COLLECTION_H__
-#define __CIRQUE_BOOTLOADER_COLLECTION_H__
-
-#include <string>
-#include <vector>
-using namespace std;
-
-#define BL_SUCCESS		   ( 0)
-#define BL_FAILURE		   (-1)
-#define BL_NOT_SUPPORTED   (-2)
-#define BL_NOT_IMPLEMENTED (-3)
-#define BL_READ_ERROR	   (-5)
-#define BL_WRITE_ERROR	   (-6)
-
-enum ErrorCodes : uint8_t
-{
-	NV_err_none,
-	NV_err_not_initialized,
-	NV_err_sector_out_of_range,
-	NV_err_offset_out_of_range,
-	NV_err_null_ptr,
-	NV_err_timeout,
-	NV_err_unknown,
-	NV_err_no_recent_image,
-	NV_err_access_violation,
-	NV_err_protection_violation,
-	NV_err_misaligned_address,
-	NV_err_cmd_unknown,
-	NV_err_chksum_mismatch
-};
-
-enum ImageLayouts : uint8_t
-{
-	Single,
-	Dual
-};
-
-enum ActiveImages : uint8_t
-{
-	None,
-	One,
-	Two
-};
-
-enum ValidationType : uint8_t
-{
-	Headers,
-	EntireImage
-};
-
-struct CirqueBootloaderStatus
-{
-	uint16_t Sentinel;
-	uint8_t Version;
-	ErrorCodes LastError;
-	uint8_t Flags;
-	ImageLayouts ImageLayout;
-	ActiveImages ActiveImage;
-	bool bBusy;
-	bool bImageValid;
-	bool bForce;
-	uint8_t AtomicWriteSize;
-	uint8_t ByteWriteDelayUs;		  // The microsecond byte write delay
-	uint8_t RegionFormatDelayMsPer1K; // The region format delay in ms/1k bytes
-};
-
-class CirqueBootloaderCollection
-{
-	private:
-	static const int BL_REPORT_LENGTH = 531;
-	static const int BL_CMD_WRITE = 0;
-	static const int BL_CMD_FLUSH = 1;
-	static const int BL_CMD_VALIDATE = 2;
-	static const int BL_CMD_RESET = 3;
-	static const int BL_CMD_FORMAT_IMAGE = 4;
-	static const int BL_CMD_FORMAT_REGION = 5;
-	static const int BL_CMD_INVOKE_BL = 6;
-	static const int BL_CMD_WRITE_MEM = 7;
-	static const int BL_CMD_READ_MEM = 8;
-
-	int report_length = 531;
-	int hid_report_id;
-	int fd;
-
-	int GenFeatureIOCTL(int length, int get_not_set);
-	int GenGETFeatureIOCTL(int length);
-	int GenSETFeatureIOCTL(int length);
-
-	void AppendU32toBuffer(uint32_t value, vector<uint8_t> &data);
-	void AppendU16toBuffer(uint16_t value, vector<uint8_t> &data);
-
-	uint32_t GetU32FromBuffer(uint8_t * buffer);
-	uint16_t GetU16FromBuffer(uint8_t * buffer);
-
-	void PadBuffer(vector<uint8_t> &data);
-	void ParseReadDataFromStatus(vector<uint8_t> &status_data, uint32_t &addr, uint16_t &length, vector<uint8_t> &return_buffer);
-	uint16_t Fletcher_16(uint8_t *dataPtr, size_t bytes);
-	uint32_t Fletcher_32(uint16_t *dataPtr, size_t bytes);
-
-	int BootloaderSetFeature(vector<uint8_t> &data);
-	int BootloaderGetFeature(vector<uint8_t> &data);
-
-	public:
-	CirqueBootloaderCollection(string& device_path, int report_id = 7);
-	~CirqueBootloaderCollection();
-	bool IsConnected() { return (this->fd != -1); }
-
-	int IS_BIG_ENDIAN;
-
-	vector<uint8_t> ExtendedRead(uint32_t addr, uint16_t length);
-	void ExtendedRead(uint32_t addr, uint16_t length, vector<uint8_t> &return_buffer);
-	void ExtendedWrite(uint32_t addr, vector<uint8_t> &data);
-
-	bool SanityCheck();
-	int GetStatus( CirqueBootloaderStatus& Status );
-	int Reset( void );
-	int Invoke( void );
-	int FormatImage( uint8_t NumRegions, uint32_t EntryPointAddress, uint8_t I2CAddress, uint16_t HIDDescriptorAddr );
-	int FormatRegion( uint8_t RegionNumber, uint32_t RegionOffset, vector<uint8_t>& data );
-	int WriteData( uint32_t WriteOffset, uint32_t NumBytes, vector<uint8_t>& data );
-	int Flush( void );
-	int Validate( ValidationType Validation );
-
-	int GetVersionInfo(uint16_t &vid, uint16_t &pid, uint16_t &ver, uint32_t &rev);
-};
-
-#endif //__CIRQUE_BOOTLOADER_COLLECTION_H__
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_BOOTLOADER_COLLECTION_H__
+#define __CIRQUE_BOOTLOADER_COLLECTION_H__
+
+#include <string>
+#include <vector>
+#include "CirqueHidTransport.h"
+#include "CirqueReportEncoder.h"
+#include "CirqueCommandStats.h"
+#include "CirqueTraceLog.h"
+#include "CirqueFirmwareImage.h"
+using namespace std;
+
+#define BL_SUCCESS		   ( 0)
+#define BL_FAILURE		   (-1)
+#define BL_NOT_SUPPORTED   (-2)
+#define BL_NOT_IMPLEMENTED (-3)
+#define BL_READ_ERROR	   (-5)
+#define BL_WRITE_ERROR	   (-6)
+#define BL_BUSY_TIMEOUT	   (-7)
+#define BL_MODE_TIMEOUT	   (-8)
+#define BL_IN_PROGRESS	   ( 1)
+
+enum ErrorCodes : uint8_t
+{
+	NV_err_none,
+	NV_err_not_initialized,
+	NV_err_sector_out_of_range,
+	NV_err_offset_out_of_range,
+	NV_err_null_ptr,
+	NV_err_timeout,
+	NV_err_unknown,
+	NV_err_no_recent_image,
+	NV_err_access_violation,
+	NV_err_protection_violation,
+	NV_err_misaligned_address,
+	NV_err_cmd_unknown,
+	NV_err_chksum_mismatch
+};
+
+enum ImageLayouts : uint8_t
+{
+	Single,
+	Dual
+};
+
+enum ActiveImages : uint8_t
+{
+	None,
+	One,
+	Two
+};
+
+enum ValidationType : uint8_t
+{
+	Headers,
+	EntireImage
+};
+
+struct CirqueBootloaderStatus
+{
+	uint16_t Sentinel;
+	uint8_t Version;
+	ErrorCodes LastError;
+	uint8_t Flags;
+	ImageLayouts ImageLayout;
+	ActiveImages ActiveImage;
+	bool bBusy;
+	bool bImageValid;
+	bool bForce;
+	uint8_t AtomicWriteSize;
+	uint8_t ByteWriteDelayUs;		  // The microsecond byte write delay
+	uint8_t RegionFormatDelayMsPer1K; // The region format delay in ms/1k bytes
+};
+
+// The region checksum FormatRegion sends, over data that may arrive in
+// pieces, such as a region decompressed a block at a time. An odd
+// trailing byte is summed as if followed by 0xFF.
+class CirqueFletcher32
+{
+	private:
+	uint32_t sum1 = 0xffff;
+	uint32_t sum2 = 0xffff;
+	uint32_t words = 0;
+	int pending = -1;
+	int big_endian;
+
+	void Word( uint8_t first, uint8_t second );
+	void Reduce();
+
+	public:
+	CirqueFletcher32( int BigEndian ) : big_endian( BigEndian ) {}
+	void Add( const uint8_t *data, size_t bytes );
+	uint32_t Value() const;
+};
+
+class CirqueBootloaderCollection
+{
+	private:
+	static const int BL_REPORT_LENGTH = CirqueReportEncoder::REPORT_LENGTH;
+
+	// Status polling backoff while waiting for a command to complete.
+	static const uint32_t BL_POLL_MIN_BACKOFF_US = 250;
+	static const uint32_t BL_POLL_MAX_BACKOFF_US = 4000;
+	static const uint32_t BL_POLL_MARGIN_US = 20000;
+
+	int hid_report_id;
+	uint8_t status_version = 0;
+	CirqueHidTransport *transport;
+	bool owns_transport;
+	CirqueReportEncoder encoder;
+
+	// State of the wait for the last command, see StartWait.
+	uint32_t wait_delay_us = 0;
+	uint32_t wait_backoff_us = 0;
+	uint64_t wait_deadline_us = 0;
+	ErrorCodes wait_error = NV_err_none;
+	int wait_mode = -1;
+
+	// The last command sent, until it completes.
+	int open_command = -1;
+	uint32_t command_bytes = 0;
+	uint64_t command_start_us = 0;
+	uint64_t command_sent_us = 0;
+
+	uint32_t GetU32FromBuffer(uint8_t * buffer);
+	uint16_t GetU16FromBuffer(uint8_t * buffer);
+
+	void ParseReadDataFromStatus(uint8_t *status_data, uint32_t &addr, uint16_t &length, vector<uint8_t> &return_buffer);
+
+	int BootloaderSetFeature(int length);
+	int BootloaderGetFeature(int length);
+	int SendCommand(int length);
+	void CloseCommand(uint64_t end_us);
+
+	public:
+	CirqueBootloaderCollection(string& device_path, int report_id = 7);
+	CirqueBootloaderCollection(CirqueHidTransport *hid_transport, int report_id = 7);
+	~CirqueBootloaderCollection();
+	bool IsConnected() { return this->transport->IsOpen(); }
+	// Data bytes that fit in one WriteData report.
+	uint32_t MaxWritePayload() { return BL_REPORT_LENGTH - CirqueReportEncoder::WRITE_HEADER_LENGTH; }
+	// Data bytes that fit in one READ_MEM reply. The status in front of the
+	// data is 3 bytes shorter before version 8.
+	uint32_t MaxReadPayload() { return BL_REPORT_LENGTH - ((this->status_version != 0 && this->status_version < 0x08) ? 6 : 9) - 6; }
+	// Data bytes the application firmware answers one READ_MEM with.
+	static const uint32_t MAX_APP_READ_PAYLOAD = 256;
+
+	int IS_BIG_ENDIAN;
+	// The region checksum FormatRegion sends, for either byte order.
+	static uint32_t Fletcher_32(const uint8_t *dataPtr, size_t bytes, int big_endian);
+	CirqueCommandStats Stats;
+	// Timeline of the device's phases, if one is being recorded.
+	CirqueTraceLog *Trace = NULL;
+	int TraceTrack = 0;
+
+	vector<uint8_t> ExtendedRead(uint32_t addr, uint16_t length);
+	void ExtendedRead(uint32_t addr, uint16_t length, vector<uint8_t> &return_buffer);
+	int BulkRead(uint32_t addr, uint8_t *data, uint32_t length, uint32_t max_chunk);
+	void ExtendedWrite(uint32_t addr, vector<uint8_t> &data);
+	void ExtendedWrite(uint32_t addr, const uint8_t *data, uint16_t length);
+
+	bool SanityCheck();
+	int GetStatus( CirqueBootloaderStatus& Status );
+	int WaitForCompletion( uint32_t DelayUs, CirqueBootloaderStatus& Status );
+	// WaitForCompletion in steps, for callers that can't block. StartWait
+	// returns the time until the first poll. PollCompletion returns
+	// BL_IN_PROGRESS and the time until the next poll while the device is busy.
+	// With a Mode, as IsBootloader returns it, the command only completes
+	// once the device answers in that mode, and BL_MODE_TIMEOUT is returned
+	// if it still answers in the other one at the deadline.
+	uint32_t StartWait( uint32_t DelayUs, int Mode = -1 );
+	int PollCompletion( CirqueBootloaderStatus& Status, uint32_t& NextPollUs );
+	int Reset( void );
+	int Invoke( void );
+	int FormatImage( uint8_t NumRegions, uint32_t EntryPointAddress, uint8_t I2CAddress, uint16_t HIDDescriptorAddr );
+	int FormatRegion( uint8_t RegionNumber, const CirqueImageRegion& region );
+	int FormatRegion( uint8_t RegionNumber, uint32_t RegionOffset, const uint8_t *data, uint32_t NumBytes );
+	int WriteData( uint32_t WriteOffset, uint32_t NumBytes, vector<uint8_t>& data );
+	int WriteData( uint32_t WriteOffset, const uint8_t *data, uint32_t NumBytes );
+	int Flush( void );
+	int Validate( ValidationType Validation );
+
+	int GetVersionInfo(uint16_t &vid, uint16_t &pid, uint16_t &ver, uint32_t &rev);
+};
+
+// Returns 1 for a bootloader sentinel, 0 for an application sentinel and -1 otherwise.
+int IsBootloader(uint16_t sentinel);
+
+#endif //__CIRQUE_BOOTLOADER_COLLECTION_H__
@@ -0,0 +1,570 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueBootloaderEmulator.h"
+#include <cstring>
+#include <fstream>
+#include <unistd.h>
+
+// Bootloader commands, as sent by CirqueBootloaderCollection.
+enum EmulatedCommands : uint8_t
+{
+	EMU_CMD_WRITE,
+	EMU_CMD_FLUSH,
+	EMU_CMD_VALIDATE,
+	EMU_CMD_RESET,
+	EMU_CMD_FORMAT_IMAGE,
+	EMU_CMD_FORMAT_REGION,
+	EMU_CMD_INVOKE_BL,
+	EMU_CMD_WRITE_MEM,
+	EMU_CMD_READ_MEM
+};
+
+static uint32_t GetU32(uint8_t *buffer)
+{
+	return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+static uint16_t GetU16(uint8_t *buffer)
+{
+	return buffer[0] | (buffer[1] << 8);
+}
+
+CirqueBootloaderEmulator::CirqueBootloaderEmulator(string& options)
+{
+	this->ParseOptions(options);
+	if (!this->state_file.empty()) this->LoadState();
+	this->InitRam();
+}
+
+CirqueBootloaderEmulator::~CirqueBootloaderEmulator()
+{
+	if (!this->state_file.empty()) this->SaveState();
+}
+
+void CirqueBootloaderEmulator::ParseOptions(string& options)
+{
+	size_t start = 0;
+	while (start < options.size())
+	{
+		size_t end = options.find(',', start);
+		if (end == string::npos) end = options.size();
+		string option = options.substr(start, end - start);
+		string value;
+		size_t equals = option.find('=');
+		if (equals != string::npos)
+		{
+			value = option.substr(equals + 1);
+			option = option.substr(0, equals);
+		}
+
+		if (option == "be") this->big_endian = 1;
+		else if (option == "bl") this->bootloader_mode = true;
+		else if (option == "legacy")
+		{
+			this->app_sentinel = 0x426C;
+			this->bl_sentinel = 0x6C42;
+			this->version = 7;
+		}
+		else if (option == "version") this->version = (uint8_t)strtoul(value.c_str(), NULL, 0);
+		else if (option == "ver") this->ver = (uint16_t)strtoul(value.c_str(), NULL, 16);
+		else if (option == "pid") this->pid = (uint16_t)strtoul(value.c_str(), NULL, 16);
+		else if (option == "busy") this->busy_percent = strtoul(value.c_str(), NULL, 0);
+		else if (option == "nodelay") this->busy_percent = 0;
+		else if (option == "i2c") this->i2c_khz = strtoul(value.c_str(), NULL, 0);
+		else if (option == "drop") this->drop_interval = strtoul(value.c_str(), NULL, 0);
+		else if (option == "state") this->state_file = value;
+		else if (option == "abort") this->abort_after = strtoul(value.c_str(), NULL, 0);
+		else if (option == "switch") this->switch_delay_ms = strtoul(value.c_str(), NULL, 0);
+		else printf("Emulator: unknown option %s\n", option.c_str());
+
+		start = end + 1;
+	}
+
+	// A device that starts in bootloader mode has no usable image.
+	if (this->bootloader_mode) this->image_valid = false;
+}
+
+void CirqueBootloaderEmulator::SetBusy(uint64_t advertised_us)
+{
+	this->busy_until_us = CirqueMonotonicUs() + advertised_us * this->busy_percent / 100;
+}
+
+// The old mode keeps answering, and isn't busy, until a delayed switch
+// takes effect.
+void CirqueBootloaderEmulator::SwitchMode(bool bootloader)
+{
+	if (this->switch_delay_ms == 0)
+	{
+		this->bootloader_mode = bootloader;
+		return;
+	}
+	this->next_bootloader_mode = bootloader;
+	this->switch_at_us = CirqueMonotonicUs() + (uint64_t)this->switch_delay_ms * 1000;
+}
+
+void CirqueBootloaderEmulator::UpdateMode()
+{
+	if (this->switch_at_us == 0 || CirqueMonotonicUs() < this->switch_at_us) return;
+	this->bootloader_mode = this->next_bootloader_mode;
+	this->switch_at_us = 0;
+}
+
+void CirqueBootloaderEmulator::Transfer(int length)
+{
+	// Nine clocks per byte, plus the I2C-HID command and address overhead.
+	if (this->i2c_khz) usleep((uint64_t)(length + 6) * 9 * 1000 / this->i2c_khz);
+}
+
+uint8_t* CirqueBootloaderEmulator::PageFor(uint32_t addr)
+{
+	uint32_t base = addr & ~(PAGE_SIZE - 1);
+	map<uint32_t, vector<uint8_t>>::iterator it = this->pages.find(base);
+	if (it == this->pages.end())
+	{
+		it = this->pages.insert(make_pair(base, vector<uint8_t>(PAGE_SIZE, 0xFF))).first;
+	}
+	return &it->second[addr - base];
+}
+
+void CirqueBootloaderEmulator::ReadMemory(uint32_t addr, uint8_t *data, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++)
+	{
+		map<uint32_t, vector<uint8_t>>::iterator it = this->pages.find((addr + i) & ~(PAGE_SIZE - 1));
+		data[i] = (it == this->pages.end()) ? 0xFF : it->second[(addr + i) & (PAGE_SIZE - 1)];
+	}
+}
+
+void CirqueBootloaderEmulator::WriteMemory(uint32_t addr, const uint8_t *data, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++)
+	{
+		*this->PageFor(addr + i) = data[i];
+	}
+}
+
+void CirqueBootloaderEmulator::EraseMemory(uint32_t addr, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++)
+	{
+		*this->PageFor(addr + i) = 0xFF;
+	}
+}
+
+void CirqueBootloaderEmulator::PutU16(uint32_t addr, uint16_t value)
+{
+	uint8_t bytes[2];
+	bytes[this->big_endian ? 1 : 0] = value & 0xFF;
+	bytes[this->big_endian ? 0 : 1] = value >> 8;
+	this->WriteMemory(addr, bytes, 2);
+}
+
+void CirqueBootloaderEmulator::PutU32(uint32_t addr, uint32_t value)
+{
+	uint8_t bytes[4];
+	for (int i = 0; i < 4; i++)
+	{
+		bytes[this->big_endian ? 3 - i : i] = (value >> (8 * i)) & 0xFF;
+	}
+	this->WriteMemory(addr, bytes, 4);
+}
+
+void CirqueBootloaderEmulator::InitRam()
+{
+	// Firmware information block.
+	uint8_t base_addr[4] = { 0x00, 0x08, 0x00, 0x20 };
+	this->WriteMemory(0x20000800, base_addr, 4);
+	this->PutU16(0x2000080A, this->vid);
+	this->PutU16(0x2000080C, this->pid);
+	this->PutU16(0x2000080E, this->ver);
+	this->PutU32(0x20000810, this->rev);
+	uint8_t endian_flag = this->big_endian ? 0x01 : 0x00;
+	this->WriteMemory(0x20000824, &endian_flag, 1);
+
+	// Sensor dimensions, axis inversion and feed control.
+	uint8_t dimensions[2] = { this->x_count, this->y_count };
+	this->WriteMemory(0x2001080C, dimensions, 2);
+	uint8_t logical_scalar_flags = 0x00;
+	this->WriteMemory(0x20080018, &logical_scalar_flags, 1);
+	uint8_t feed[2] = { 0x01, 0x02 };
+	this->WriteMemory(0x200E0009, feed, 2);
+}
+
+void CirqueBootloaderEmulator::FillImage(uint32_t base_addr)
+{
+	uint32_t image_index = (base_addr - IMAGE_MAILBOX_BASE) >> 16;
+	uint16_t count = this->x_count * this->y_count;
+
+	// Length is always little-endian, the samples follow the firmware.
+	uint8_t length[2] = { (uint8_t)((count * 2) & 0xFF), (uint8_t)((count * 2) >> 8) };
+	this->WriteMemory(base_addr, length, 2);
+
+	this->frame++;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		int16_t sample = (int16_t)(image_index * 100 + (i % this->x_count) * 3 + (i / this->x_count) * 2 + (this->frame & 0x07));
+		this->PutU16(base_addr + 2 + i * 2, (uint16_t)sample);
+	}
+}
+
+uint32_t CirqueBootloaderEmulator::RegionChecksum(EmulatedRegion& region)
+{
+	// Fletcher-32 over the flash contents as the device reads them.
+	CirqueFletcher32 checksum(this->big_endian);
+	uint8_t bytes[256];
+	for (uint32_t done = 0; done < region.Size; )
+	{
+		uint32_t count = (region.Size - done > sizeof(bytes)) ? sizeof(bytes) : region.Size - done;
+		this->ReadMemory(region.Offset + done, bytes, count);
+		checksum.Add(bytes, count);
+		done += count;
+	}
+	return checksum.Value();
+}
+
+bool CirqueBootloaderEmulator::InRegion(uint32_t offset, uint32_t length)
+{
+	for (size_t i = 0; i < this->regions.size(); i++)
+	{
+		if (offset >= this->regions[i].Offset &&
+			(uint64_t)offset + length <= (uint64_t)this->regions[i].Offset + this->regions[i].Size)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CirqueBootloaderEmulator::CmdWrite(uint8_t *data, int length)
+{
+	uint32_t offset = GetU32(&data[2]);
+	uint32_t count = GetU32(&data[6]);
+
+	if (count > (uint32_t)(length - 10))
+	{
+		this->last_error = NV_err_offset_out_of_range;
+		return;
+	}
+	if ((offset & 1) || (count & 1))
+	{
+		this->last_error = NV_err_misaligned_address;
+		return;
+	}
+	if (!this->InRegion(offset, count))
+	{
+		this->last_error = NV_err_offset_out_of_range;
+		return;
+	}
+	if (this->drop_interval && ++this->write_count % this->drop_interval == 0)
+	{
+		this->last_error = NV_err_timeout;
+		return;
+	}
+
+	this->WriteMemory(offset, &data[10], count);
+
+	if (this->abort_after && ++this->writes_done == this->abort_after)
+	{
+		printf("Emulator: aborting after %d writes\n", this->writes_done);
+		if (!this->state_file.empty()) this->SaveState();
+		fflush(stdout);
+		_exit(1);
+	}
+
+	// Atomic units that are only partially covered need a read-modify-write.
+	uint64_t busy_us = (uint64_t)this->byte_write_delay_us * count;
+	if (this->atomic_write_size > 1)
+	{
+		if (offset % this->atomic_write_size) busy_us += this->byte_write_delay_us * this->atomic_write_size;
+		if ((offset + count) % this->atomic_write_size) busy_us += this->byte_write_delay_us * this->atomic_write_size;
+	}
+	this->SetBusy(busy_us);
+}
+
+void CirqueBootloaderEmulator::CmdValidate(ValidationType validation)
+{
+	if (this->regions.empty())
+	{
+		this->last_error = NV_err_no_recent_image;
+		return;
+	}
+	if (this->regions.size() != this->num_regions)
+	{
+		this->last_error = NV_err_not_initialized;
+		return;
+	}
+
+	size_t count = (validation == Headers) ? 1 : this->regions.size();
+	uint32_t bytes = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		bytes += this->regions[i].Size;
+		if (this->RegionChecksum(this->regions[i]) != this->regions[i].Checksum)
+		{
+			this->last_error = NV_err_chksum_mismatch;
+			this->image_valid = false;
+			return;
+		}
+	}
+
+	if (validation == EntireImage) this->image_valid = true;
+	this->SetBusy(2000 + bytes / 8);
+}
+
+void CirqueBootloaderEmulator::CmdFormatImage(uint8_t *data)
+{
+	for (size_t i = 0; i < this->regions.size(); i++)
+	{
+		this->EraseMemory(this->regions[i].Offset, this->regions[i].Size);
+	}
+	this->regions.clear();
+	this->image_valid = false;
+	this->num_regions = data[3];
+	this->entry_point = GetU32(&data[4]);
+	this->SetBusy(20000);
+}
+
+void CirqueBootloaderEmulator::CmdFormatRegion(uint8_t *data)
+{
+	EmulatedRegion region;
+	uint8_t number = data[2];
+	region.Offset = GetU32(&data[3]);
+	region.Size = GetU32(&data[7]);
+	region.Checksum = GetU32(&data[11]);
+
+	if (number != this->regions.size() || number >= this->num_regions)
+	{
+		this->last_error = NV_err_sector_out_of_range;
+		return;
+	}
+	if (region.Offset >= RAM_BASE || region.Size > RAM_BASE - region.Offset)
+	{
+		this->last_error = NV_err_access_violation;
+		return;
+	}
+
+	this->EraseMemory(region.Offset, region.Size);
+	this->regions.push_back(region);
+	this->SetBusy((uint64_t)this->region_format_delay_ms * 1000 * ((region.Size + 1023) / 1024));
+}
+
+void CirqueBootloaderEmulator::CmdWriteMem(uint8_t *data, int length)
+{
+	uint32_t addr = GetU32(&data[2]);
+	uint16_t count = GetU16(&data[6]);
+
+	if (8 + count + 2 > length)
+	{
+		this->last_error = NV_err_offset_out_of_range;
+		return;
+	}
+	if (CirqueReportEncoder::Fletcher_16(&data[1], 1 + 4 + 2 + count) != GetU16(&data[8 + count]))
+	{
+		this->last_error = NV_err_chksum_mismatch;
+		return;
+	}
+	if (addr < RAM_BASE)
+	{
+		this->last_error = NV_err_protection_violation;
+		return;
+	}
+
+	this->WriteMemory(addr, &data[8], count);
+
+	// Writing 1 to an image mailbox requests a new image.
+	if (addr >= IMAGE_MAILBOX_BASE && (addr & 0xFFFF) == 0 && count > 0 && data[8] == 0x01)
+	{
+		this->FillImage(addr);
+	}
+	else if (addr >= IMAGE_MAILBOX_BASE && (addr & 0xFFFF) == 0 && count > 0 && data[8] == 0x00)
+	{
+		uint8_t released[2] = { 0, 0 };
+		this->WriteMemory(addr, released, 2);
+	}
+}
+
+int CirqueBootloaderEmulator::SetFeature(uint8_t *data, int length)
+{
+	if (length < 1 || data[0] != REPORT_ID) return -1;
+	this->Transfer(length);
+	this->UpdateMode();
+	if (length < 2) return length;
+
+	uint8_t command = data[1];
+	bool flash_command = command != EMU_CMD_READ_MEM && command != EMU_CMD_WRITE_MEM;
+
+	// The device drops commands that arrive while it is busy.
+	if (flash_command && this->IsBusy())
+	{
+		this->last_error = NV_err_timeout;
+		return length;
+	}
+
+	// Only the bootloader accepts flash commands.
+	if (!this->bootloader_mode && command <= EMU_CMD_FORMAT_REGION && command != EMU_CMD_RESET)
+	{
+		this->last_error = NV_err_cmd_unknown;
+		return length;
+	}
+
+	switch (command)
+	{
+		case EMU_CMD_WRITE:
+			this->CmdWrite(data, length);
+			break;
+		case EMU_CMD_FLUSH:
+			this->SetBusy(5000);
+			break;
+		case EMU_CMD_VALIDATE:
+			this->CmdValidate((ValidationType)data[2]);
+			break;
+		case EMU_CMD_RESET:
+			// Errors are latched until a reset.
+			this->last_error = NV_err_none;
+			if (this->bootloader_mode && this->image_valid) this->SwitchMode(false);
+			this->SetBusy(50000);
+			break;
+		case EMU_CMD_FORMAT_IMAGE:
+			this->CmdFormatImage(data);
+			break;
+		case EMU_CMD_FORMAT_REGION:
+			this->CmdFormatRegion(data);
+			break;
+		case EMU_CMD_INVOKE_BL:
+			this->SwitchMode(true);
+			this->SetBusy(50000);
+			break;
+		case EMU_CMD_WRITE_MEM:
+			this->CmdWriteMem(data, length);
+			break;
+		case EMU_CMD_READ_MEM:
+			this->read_addr = GetU32(&data[2]);
+			this->read_length = GetU16(&data[6]);
+			if (!this->bootloader_mode && this->read_length > APP_READ_LENGTH)
+			{
+				this->read_length = 0;
+				this->last_error = NV_err_offset_out_of_range;
+			}
+			break;
+		default:
+			this->last_error = NV_err_cmd_unknown;
+			break;
+	}
+
+	return length;
+}
+
+int CirqueBootloaderEmulator::GetFeature(uint8_t *data, int length)
+{
+	if (length < 9 || data[0] != REPORT_ID) return -1;
+	this->Transfer(length);
+	this->UpdateMode();
+
+	memset(&data[1], 0, length - 1);
+
+	uint16_t sentinel = this->bootloader_mode ? this->bl_sentinel : this->app_sentinel;
+	data[1] = sentinel & 0xFF;
+	data[2] = sentinel >> 8;
+	data[3] = this->version;
+	data[4] = this->last_error;
+	data[5] = (this->IsBusy() ? 0x08 : 0x00) | (this->image_valid ? 0x10 : 0x00);
+
+	int index = 6;
+	if (this->version >= 8)
+	{
+		data[6] = this->atomic_write_size;
+		data[7] = this->byte_write_delay_us;
+		data[8] = this->region_format_delay_ms;
+		index = 9;
+	}
+
+	// Data from the last READ_MEM request follows the status.
+	uint16_t count = this->read_length;
+	if (count > length - index - 6) count = length - index - 6;
+	for (int i = 0; i < 4; i++) data[index + i] = (this->read_addr >> (8 * i)) & 0xFF;
+	data[index + 4] = count & 0xFF;
+	data[index + 5] = count >> 8;
+	this->ReadMemory(this->read_addr, &data[index + 6], count);
+
+	return length;
+}
+
+void CirqueBootloaderEmulator::LoadState()
+{
+	ifstream file(this->state_file, ios::binary | ios::in);
+	if (!file.is_open()) return;
+
+	char magic[8] = { 0 };
+	uint8_t flags[3] = { 0 };
+	uint32_t count = 0;
+	if (!file.read(magic, 8) || memcmp(magic, "CirqEmu", 8) != 0) return;
+	file.read((char*)flags, 3);
+	this->bootloader_mode = flags[0] != 0;
+	this->image_valid = flags[1] != 0;
+	this->num_regions = flags[2];
+	file.read((char*)&this->entry_point, 4);
+
+	file.read((char*)&count, 4);
+	for (uint32_t i = 0; i < count && file; i++)
+	{
+		EmulatedRegion region;
+		file.read((char*)&region, sizeof(region));
+		this->regions.push_back(region);
+	}
+
+	file.read((char*)&count, 4);
+	for (uint32_t i = 0; i < count && file; i++)
+	{
+		uint32_t base = 0;
+		vector<uint8_t> page(PAGE_SIZE);
+		file.read((char*)&base, 4);
+		file.read((char*)page.data(), PAGE_SIZE);
+		this->pages[base] = page;
+	}
+}
+
+void CirqueBootloaderEmulator::SaveState()
+{
+	ofstream file(this->state_file, ios::binary | ios::out | ios::trunc);
+	if (!file.is_open())
+	{
+		printf("Emulator: could not save state to %s\n", this->state_file.c_str());
+		return;
+	}
+
+	uint8_t flags[3] = { this->bootloader_mode, this->image_valid, this->num_regions };
+	file.write("CirqEmu", 8);
+	file.write((char*)flags, 3);
+	file.write((char*)&this->entry_point, 4);
+
+	uint32_t count = this->regions.size();
+	file.write((char*)&count, 4);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		file.write((char*)&this->regions[i], sizeof(EmulatedRegion));
+	}
+
+	// Only flash is persistent.
+	count = 0;
+	for (map<uint32_t, vector<uint8_t>>::iterator it = this->pages.begin(); it != this->pages.end() && it->first < RAM_BASE; ++it) count++;
+	file.write((char*)&count, 4);
+	for (map<uint32_t, vector<uint8_t>>::iterator it = this->pages.begin(); it != this->pages.end() && it->first < RAM_BASE; ++it)
+	{
+		file.write((char*)&it->first, 4);
+		file.write((char*)it->second.data(), PAGE_SIZE);
+	}
+}
@@ -0,0 +1,143 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_BOOTLOADER_EMULATOR_H__
+#define __CIRQUE_BOOTLOADER_EMULATOR_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "CirqueHidTransport.h"
+#include "CirqueBootloaderCollection.h"
+#include "CirqueTiming.h"
+
+using namespace std;
+
+// Software model of the report 7 bootloader and of the parts of the
+// application firmware the tool talks to. Busy periods are derived from the
+// advertised delays and elapse in real time, so host-side waits behave as
+// they do against a touchpad.
+//
+// Options (comma separated):
+//   be            big-endian firmware
+//   bl            start in bootloader mode
+//   legacy        old 'Bl'/'lB' sentinels and a version 7 status report
+//   version=<n>   bootloader status version (default 9)
+//   ver=<hex>     firmware version reported in application mode
+//   pid=<hex>     product ID reported in application mode
+//   busy=<n>      actual busy time in percent of the advertised delays
+//   nodelay       never report busy
+//   i2c=<kHz>     delay each report by its transfer time on an I2C bus
+//   drop=<n>      drop every n-th WRITE command, as if it arrived while busy
+//   state=<path>  load flash contents from and save them to a file
+//   abort=<n>     save the state and end the process after the n-th WRITE,
+//                 as if the host lost power in the middle of an update
+class CirqueBootloaderEmulator : public CirqueHidTransport
+{
+	private:
+	static const int REPORT_ID = 7;
+	static const int REPORT_LENGTH = 531;
+	static const uint32_t PAGE_SIZE = 4096;
+	static const uint32_t RAM_BASE = 0x20000000;
+	static const uint32_t IMAGE_MAILBOX_BASE = 0x30000000;
+	// The application firmware answers READ_MEM with at most this many bytes.
+	static const uint16_t APP_READ_LENGTH = 256;
+
+	struct EmulatedRegion
+	{
+		uint32_t Offset;
+		uint32_t Size;
+		uint32_t Checksum;
+	};
+
+	map<uint32_t, vector<uint8_t>> pages;
+	vector<EmulatedRegion> regions;
+
+	bool bootloader_mode = false;
+	bool image_valid = true;
+	int big_endian = 0;
+	uint16_t app_sentinel = 0x5AC3;
+	uint16_t bl_sentinel = 0xC35A;
+	uint8_t version = 9;
+	ErrorCodes last_error = NV_err_none;
+	uint8_t atomic_write_size = 64;
+	uint8_t byte_write_delay_us = 10;
+	uint8_t region_format_delay_ms = 50;
+	uint32_t busy_percent = 60;
+	uint64_t busy_until_us = 0;
+	uint32_t i2c_khz = 0;
+	uint32_t drop_interval = 0;
+	uint32_t write_count = 0;
+	uint32_t abort_after = 0;
+	uint32_t writes_done = 0;
+	// Reset and Invoke change the mode this much later, see SwitchMode.
+	uint32_t switch_delay_ms = 0;
+	uint64_t switch_at_us = 0;
+	bool next_bootloader_mode = false;
+
+	uint8_t num_regions = 0;
+	uint32_t entry_point = 0;
+	uint32_t read_addr = 0;
+	uint16_t read_length = 0;
+
+	uint16_t vid = 0x0488;
+	uint16_t pid = 0x0001;
+	uint16_t ver = 0x0100;
+	uint32_t rev = 0x00001000;
+	uint8_t x_count = 16;
+	uint8_t y_count = 12;
+	uint32_t frame = 0;
+
+	string state_file;
+
+	bool IsBusy() { return CirqueMonotonicUs() < this->busy_until_us; }
+	void SetBusy(uint64_t advertised_us);
+	void SwitchMode(bool bootloader);
+	void UpdateMode();
+	void Transfer(int length);
+
+	uint8_t* PageFor(uint32_t addr);
+	void ReadMemory(uint32_t addr, uint8_t *data, uint32_t length);
+	void WriteMemory(uint32_t addr, const uint8_t *data, uint32_t length);
+	void EraseMemory(uint32_t addr, uint32_t length);
+	void PutU16(uint32_t addr, uint16_t value);
+	void PutU32(uint32_t addr, uint32_t value);
+	void InitRam();
+	void FillImage(uint32_t base_addr);
+
+	uint32_t RegionChecksum(EmulatedRegion& region);
+	bool InRegion(uint32_t offset, uint32_t length);
+
+	void CmdWrite(uint8_t *data, int length);
+	void CmdValidate(ValidationType validation);
+	void CmdFormatImage(uint8_t *data);
+	void CmdFormatRegion(uint8_t *data);
+	void CmdWriteMem(uint8_t *data, int length);
+
+	void ParseOptions(string& options);
+	void LoadState();
+	void SaveState();
+
+	public:
+	CirqueBootloaderEmulator(string& options);
+	~CirqueBootloaderEmulator();
+
+	bool IsOpen() { return true; }
+	int SetFeature(uint8_t *data, int length);
+	int GetFeature(uint8_t *data, int length);
+};
+
+#endif //__CIRQUE_BOOTLOADER_EMULATOR_H__
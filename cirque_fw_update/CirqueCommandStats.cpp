@@ -0,0 +1,100 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueCommandStats.h"
+#include <algorithm>
+
+const char* CirqueCommandStats::KindName( int kind )
+{
+	static const char* names[STAT_KIND_COUNT] =
+	{
+		"write", "flush", "validate", "reset", "format_image", "format_region",
+		"invoke", "write_mem", "read_mem", "set_feature", "get_feature"
+	};
+	return names[kind];
+}
+
+uint32_t CirqueCommandStats::Percentile( vector<uint32_t>& sorted, int percent )
+{
+	if( sorted.empty() ) return 0;
+	size_t rank = ( sorted.size() * percent + 99 ) / 100;
+	return sorted[( rank > 0 ) ? rank - 1 : 0];
+}
+
+void CirqueCommandStats::Record( int kind, uint32_t us, uint32_t bytes )
+{
+	CirqueLatency& latency = this->Kinds[kind];
+	if( latency.Count == 0 || us < latency.MinUs ) latency.MinUs = us;
+	if( us > latency.MaxUs ) latency.MaxUs = us;
+	latency.Count++;
+	latency.TotalUs += us;
+	latency.Bytes += bytes;
+	latency.Samples.push_back( us );
+}
+
+void CirqueCommandStats::Print( FILE* out )
+{
+	fprintf( out, "%-14s %7s %10s %8s %8s %8s %8s %8s %10s\n", "Command", "count", "total ms", "min us", "p50 us", "p90 us", "p99 us", "max us", "bytes" );
+	for( int kind = 0; kind < STAT_KIND_COUNT; kind++ )
+	{
+		CirqueLatency& latency = this->Kinds[kind];
+		if( latency.Count == 0 ) continue;
+
+		vector<uint32_t> sorted = latency.Samples;
+		sort( sorted.begin(), sorted.end() );
+		fprintf( out, "%-14s %7u %10.1f %8u %8u %8u %8u %8u %10llu\n", KindName( kind ), latency.Count, latency.TotalUs / 1000.0,
+			latency.MinUs, Percentile( sorted, 50 ), Percentile( sorted, 90 ), Percentile( sorted, 99 ), latency.MaxUs,
+			(unsigned long long)latency.Bytes );
+	}
+	fprintf( out, "Status polls: %u, sleep: %.1f ms\n", this->StatusPolls, this->SleepUs / 1000.0 );
+}
+
+void CirqueCommandStats::PrintJson( FILE* out, const char* indent )
+{
+	fprintf( out, "%s\"status_polls\": %u,\n", indent, this->StatusPolls );
+	fprintf( out, "%s\"sleep_us\": %llu,\n", indent, (unsigned long long)this->SleepUs );
+	fprintf( out, "%s\"commands\": {", indent );
+
+	bool first = true;
+	for( int kind = 0; kind < STAT_KIND_COUNT; kind++ )
+	{
+		CirqueLatency& latency = this->Kinds[kind];
+		if( latency.Count == 0 ) continue;
+
+		vector<uint32_t> sorted = latency.Samples;
+		sort( sorted.begin(), sorted.end() );
+
+		// Bucket n counts latencies below 2^n us, down to the previous bucket.
+		uint32_t histogram[HISTOGRAM_BUCKETS] = { 0 };
+		int buckets = 0;
+		for( size_t i = 0; i < sorted.size(); i++ )
+		{
+			int bucket = 0;
+			while( bucket < HISTOGRAM_BUCKETS - 1 && sorted[i] >= ( 1u << bucket ) ) bucket++;
+			histogram[bucket]++;
+			if( bucket + 1 > buckets ) buckets = bucket + 1;
+		}
+
+		fprintf( out, "%s\n%s  \"%s\": { \"count\": %u, \"total_us\": %llu, \"min_us\": %u, \"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u, \"bytes\": %llu, \"histogram_log2_us\": [",
+			first ? "" : ",", indent, KindName( kind ), latency.Count, (unsigned long long)latency.TotalUs, latency.MinUs,
+			Percentile( sorted, 50 ), Percentile( sorted, 90 ), Percentile( sorted, 99 ), latency.MaxUs, (unsigned long long)latency.Bytes );
+		for( int bucket = 0; bucket < buckets; bucket++ )
+			fprintf( out, "%s%u", bucket ? ", " : "", histogram[bucket] );
+		fprintf( out, "] }" );
+		first = false;
+	}
+	fprintf( out, "\n%s}\n", indent );
+}
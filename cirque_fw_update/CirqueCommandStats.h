@@ -0,0 +1,78 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_COMMAND_STATS_H__
+#define __CIRQUE_COMMAND_STATS_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// The bootloader commands come first, numbered like BL_CMD_*, followed by
+// the raw feature report transfers.
+enum CommandStatKind
+{
+	STAT_WRITE,
+	STAT_FLUSH,
+	STAT_VALIDATE,
+	STAT_RESET,
+	STAT_FORMAT_IMAGE,
+	STAT_FORMAT_REGION,
+	STAT_INVOKE,
+	STAT_WRITE_MEM,
+	STAT_READ_MEM,
+	STAT_SET_FEATURE,
+	STAT_GET_FEATURE,
+	STAT_KIND_COUNT
+};
+
+struct CirqueLatency
+{
+	uint32_t Count = 0;
+	uint64_t TotalUs = 0;
+	uint32_t MinUs = 0;
+	uint32_t MaxUs = 0;
+	uint64_t Bytes = 0;
+	vector<uint32_t> Samples;
+};
+
+// Latency of every feature report and bootloader command of one device.
+// A command's latency runs from sending it until the device reports it
+// complete, or until the next command if nobody waited for it. Sleep time
+// is the time spent waiting on the device between reports.
+class CirqueCommandStats
+{
+	private:
+	static const int HISTOGRAM_BUCKETS = 24;
+
+	static const char* KindName( int kind );
+	static uint32_t Percentile( vector<uint32_t>& sorted, int percent );
+
+	public:
+	CirqueLatency Kinds[STAT_KIND_COUNT];
+	uint32_t StatusPolls = 0;
+	uint64_t SleepUs = 0;
+
+	void Record( int kind, uint32_t us, uint32_t bytes = 0 );
+	void Print( FILE* out );
+	// Writes the stats as the members of a JSON object, one per line,
+	// each line starting with indent.
+	void PrintJson( FILE* out, const char* indent );
+};
+
+#endif //__CIRQUE_COMMAND_STATS_H__
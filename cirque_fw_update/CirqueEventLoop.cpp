@@ -0,0 +1,101 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueEventLoop.h"
+#include <cstdio>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+int CirqueEventLoop::Run()
+{
+	size_t count = sessions.size();
+	vector<struct pollfd> fds( count );
+	vector<bool> due( count, true );
+	size_t active = count;
+	int retval = BL_SUCCESS;
+
+	for( size_t i = 0; i < count; i++ )
+	{
+		fds[i].fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+		if( fds[i].fd == -1 )
+		{
+			printf( "CirqueEventLoop::Run: timerfd_create failed with %d\n", errno );
+			active = 0;
+			retval = BL_FAILURE;
+		}
+	}
+
+	while( active > 0 )
+	{
+		// Step every session that is due. A session that asks for no delay
+		// stays due, and poll() only checks the timers without sleeping.
+		bool ready = false;
+		for( size_t i = 0; i < count; i++ )
+		{
+			if( !due[i] ) continue;
+
+			int64_t delay = sessions[i]->Step();
+			if( delay < 0 )
+			{
+				close( fds[i].fd );
+				fds[i].fd = -1;
+				due[i] = false;
+				active--;
+			}
+			else if( delay == 0 )
+			{
+				ready = true;
+			}
+			else
+			{
+				struct itimerspec timer = {};
+				timer.it_value.tv_sec = delay / 1000000;
+				timer.it_value.tv_nsec = ( delay % 1000000 ) * 1000;
+				timerfd_settime( fds[i].fd, 0, &timer, NULL );
+				due[i] = false;
+			}
+		}
+		if( active == 0 ) break;
+
+		int n = poll( fds.data(), count, ready ? 0 : -1 );
+		if( n < 0 )
+		{
+			if( errno == EINTR ) continue;
+			printf( "CirqueEventLoop::Run: poll failed with %d\n", errno );
+			retval = BL_FAILURE;
+			break;
+		}
+
+		for( size_t i = 0; i < count; i++ )
+		{
+			if( fds[i].fd == -1 || !( fds[i].revents & POLLIN ) ) continue;
+
+			uint64_t expirations;
+			if( read( fds[i].fd, &expirations, sizeof( expirations ) ) == sizeof( expirations ) ) due[i] = true;
+		}
+	}
+
+	for( size_t i = 0; i < count; i++ )
+	{
+		if( fds[i].fd != -1 ) close( fds[i].fd );
+	}
+
+	return retval;
+}
@@ -0,0 +1,41 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_EVENT_LOOP_H__
+#define __CIRQUE_EVENT_LOOP_H__
+
+#include <vector>
+#include "CirqueUpdateSession.h"
+
+using namespace std;
+
+// Runs update sessions on one thread. Each session has a timerfd that is
+// armed with the delay its last step asked for, and poll() sleeps until the
+// next one is due. Feature reports themselves are synchronous ioctls, so
+// only the waits between them are multiplexed.
+class CirqueEventLoop
+{
+	private:
+	vector<CirqueUpdateSession*> sessions;
+
+	public:
+	void Add( CirqueUpdateSession* session ) { sessions.push_back( session ); }
+	// Returns once every session has finished, or BL_FAILURE if the loop
+	// itself fails. The sessions hold their own results.
+	int Run();
+};
+
+#endif //__CIRQUE_EVENT_LOOP_H__
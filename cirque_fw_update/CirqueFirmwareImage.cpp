@@ -0,0 +1,313 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include "CirqueFirmwareImage.h"
+#include "CirqueLzCodec.h"
+
+void CirqueFirmwareImage::Reserve( size_t data_bytes, size_t region_count )
+{
+	arena.reserve( arena.size() + data_bytes + region_count * ( ALIGNMENT - 1 ) );
+	regions.reserve( regions.size() + region_count );
+}
+
+uint8_t* CirqueFirmwareImage::Extend( uint32_t address, uint32_t length )
+{
+	if( regions.empty() || regions.back().Address + regions.back().Length != address )
+		return AddRegion( address, length );
+
+	Unmap();
+	Descriptor& region = regions.back();
+	size_t offset = region.Offset + region.Length;
+	arena.resize( offset + length );
+	region.Length += length;
+	region.HasChecksums = false;
+	bytes += length;
+	return arena.data() + offset;
+}
+
+uint8_t* CirqueFirmwareImage::AddRegion( uint32_t address, uint32_t length )
+{
+	Unmap();
+	size_t offset = ( arena.size() + ALIGNMENT - 1 ) & ~(size_t)( ALIGNMENT - 1 );
+	Descriptor region = { address, (uint32_t)offset, length, false, { 0, 0 } };
+	regions.push_back( region );
+	arena.resize( offset + length );
+	bytes += length;
+	return arena.data() + offset;
+}
+
+void CirqueFirmwareImage::Append( uint32_t address, const uint8_t *data, uint32_t length )
+{
+	if( length == 0 ) return;
+	memcpy( Extend( address, length ), data, length );
+}
+
+void CirqueFirmwareImage::Append( const CirqueFirmwareImage& image )
+{
+	Reserve( image.bytes, image.regions.size() );
+	for( size_t i = 0; i < image.Count(); i++ )
+	{
+		CirqueImageRegion region = image[i];
+		const uint8_t *data = image.View( i, 0, region.Size );
+		if( data ) Append( region.Address, data, region.Size );
+	}
+}
+
+void CirqueFirmwareImage::Clear()
+{
+	if( mapping ) munmap( (void*)mapping, mapping_size );
+	mapping = NULL;
+	mapping_size = 0;
+	block_size = 0;
+	block_region = SIZE_MAX;
+	arena.clear();
+	regions.clear();
+	bytes = 0;
+}
+
+CirqueFirmwareImage& CirqueFirmwareImage::operator=( CirqueFirmwareImage&& image ) noexcept
+{
+	if( this == &image ) return *this;
+	Clear();
+	arena = move( image.arena );
+	regions = move( image.regions );
+	bytes = image.bytes;
+	mapping = image.mapping;
+	mapping_size = image.mapping_size;
+	block_size = image.block_size;
+	image.mapping = NULL;
+	image.Clear();
+	return *this;
+}
+
+void CirqueFirmwareImage::Map( const uint8_t *map, size_t size, uint32_t compressed_block_size )
+{
+	Clear();
+	mapping = map;
+	mapping_size = size;
+	block_size = compressed_block_size;
+}
+
+void CirqueFirmwareImage::AddMappedRegion( uint32_t address, uint32_t offset, uint32_t length, uint32_t checksum_little, uint32_t checksum_big )
+{
+	Descriptor region = { address, offset, length, true, { checksum_little, checksum_big } };
+	regions.push_back( region );
+	bytes += length;
+}
+
+void CirqueFirmwareImage::AddMappedRegion( uint32_t address, uint32_t offset, uint32_t length )
+{
+	Descriptor region = { address, offset, length, false, { 0, 0 } };
+	regions.push_back( region );
+	bytes += length;
+}
+
+// Decompresses block index of region i into block, unless it is there
+// already. Everything read from the mapping is checked against its size.
+bool CirqueFirmwareImage::LoadBlock( size_t i, uint32_t index ) const
+{
+	if( block_region == i && block_index == index ) return true;
+	block_region = SIZE_MAX;
+
+	const Descriptor& d = regions[i];
+	uint32_t blocks = RegionBlocks( d.Length, block_size );
+	if( index >= blocks || (uint64_t)d.Offset + ( blocks + 1 ) * sizeof( uint32_t ) > mapping_size ) return false;
+	uint32_t table[2];
+	memcpy( table, mapping + d.Offset + index * sizeof( uint32_t ), sizeof( table ) );
+	if( table[0] > table[1] || table[1] > mapping_size ) return false;
+
+	uint32_t length = ( d.Length - index * block_size < block_size ) ? d.Length - index * block_size : block_size;
+	uint32_t stored = table[1] - table[0];
+	block.resize( block_size );
+	if( stored == length )
+		memcpy( block.data(), mapping + table[0], length );
+	else if( stored > length || !CirqueLzCodec::Decompress( mapping + table[0], stored, block.data(), length ) )
+		return false;
+
+	block_region = i;
+	block_index = index;
+	return true;
+}
+
+const uint8_t* CirqueFirmwareImage::View( size_t i, uint32_t offset, uint32_t length ) const
+{
+	if( block_size == 0 ) return Storage() + regions[i].Offset + offset;
+
+	// Most reads fall within one block and need no copy.
+	uint32_t index = offset / block_size;
+	if( length == 0 || ( offset + length - 1 ) / block_size == index )
+		return LoadBlock( i, index ) ? block.data() + offset % block_size : NULL;
+
+	view.resize( length );
+	for( uint32_t done = 0; done < length; )
+	{
+		uint32_t at = offset + done;
+		uint32_t piece = block_size - at % block_size;
+		if( piece > length - done ) piece = length - done;
+		if( !LoadBlock( i, at / block_size ) ) return NULL;
+		memcpy( view.data() + done, block.data() + at % block_size, piece );
+		done += piece;
+	}
+	return view.data();
+}
+
+// Copies the regions of a mapped image into an arena before it changes.
+// Compressed images were checked when they were loaded, so a region that
+// fails to decompress now is left erased.
+void CirqueFirmwareImage::Unmap()
+{
+	if( mapping == NULL ) return;
+
+	vector<uint8_t> copy;
+	size_t size = 0;
+	for( size_t i = 0; i < regions.size(); i++ )
+		size = ( ( size + ALIGNMENT - 1 ) & ~(size_t)( ALIGNMENT - 1 ) ) + regions[i].Length;
+	copy.reserve( size );
+	for( size_t i = 0; i < regions.size(); i++ )
+	{
+		size_t offset = ( copy.size() + ALIGNMENT - 1 ) & ~(size_t)( ALIGNMENT - 1 );
+		copy.resize( offset + regions[i].Length );
+		if( block_size == 0 )
+		{
+			memcpy( copy.data() + offset, mapping + regions[i].Offset, regions[i].Length );
+		}
+		else
+		{
+			for( uint32_t at = 0; at < regions[i].Length; at += block_size )
+			{
+				uint32_t piece = ( regions[i].Length - at < block_size ) ? regions[i].Length - at : block_size;
+				const uint8_t *data = View( i, at, piece );
+				if( data ) memcpy( copy.data() + offset + at, data, piece );
+				else memset( copy.data() + offset + at, 0xFF, piece );
+			}
+		}
+		regions[i].Offset = (uint32_t)offset;
+	}
+
+	munmap( (void*)mapping, mapping_size );
+	mapping = NULL;
+	mapping_size = 0;
+	block_size = 0;
+	block_region = SIZE_MAX;
+	arena = move( copy );
+}
+
+bool CirqueFirmwareImage::Coalesce( uint32_t max_gap, uint32_t& conflict, uint32_t& filled )
+{
+	filled = 0;
+
+	// Most images are already in order with nothing to join or pad.
+	bool joinable = false;
+	for( size_t i = 0; i < regions.size() && !joinable; i++ )
+	{
+		joinable = ( ( regions[i].Address | regions[i].Length ) & 1 ) != 0;
+		if( i == 0 || joinable ) continue;
+		uint64_t end = (uint64_t)regions[i - 1].Address + regions[i - 1].Length;
+		joinable = regions[i].Address < end || regions[i].Address - end <= max_gap;
+	}
+	if( !joinable ) return true;
+	Unmap();
+
+	vector<size_t> order( regions.size() );
+	for( size_t i = 0; i < order.size(); i++ ) order[i] = i;
+	stable_sort( order.begin(), order.end(), [this]( size_t a, size_t b ) { return regions[a].Address < regions[b].Address; } );
+
+	CirqueFirmwareImage joined;
+	joined.Reserve( bytes, regions.size() );
+	uint64_t end = 0;
+	for( size_t i = 0; i < order.size(); i++ )
+	{
+		CirqueImageRegion region = ( *this )[order[i]];
+		uint64_t region_end = (uint64_t)region.Address + region.Size;
+
+		// The device writes whole 16 bit words, so regions are widened to
+		// even bounds and joined if the widened regions would touch.
+		uint32_t start = region.Address & ~1u;
+		if( joined.Empty() || start > ( ( end + 1 ) & ~1ull ) + max_gap )
+		{
+			if( end & 1 )
+			{
+				*joined.Extend( (uint32_t)end, 1 ) = 0xFF;
+				filled++;
+			}
+			joined.AddRegion( start, 0 );
+			if( start != region.Address )
+			{
+				*joined.Extend( start, 1 ) = 0xFF;
+				filled++;
+			}
+		}
+		else if( region.Address < end )
+		{
+			// The overlapping bytes must agree.
+			const Descriptor& last = joined.regions.back();
+			uint32_t overlap = (uint32_t)( min( end, region_end ) - region.Address );
+			const uint8_t *existing = joined.arena.data() + last.Offset + ( region.Address - last.Address );
+			for( uint32_t j = 0; j < overlap; j++ )
+			{
+				if( existing[j] != region.Data[j] )
+				{
+					conflict = region.Address + j;
+					return false;
+				}
+			}
+			if( region_end <= end ) continue;
+			uint32_t skip = (uint32_t)( end - region.Address );
+			region.Address += skip;
+			region.Data += skip;
+			region.Size -= skip;
+		}
+		else if( region.Address > end )
+		{
+			uint32_t gap = (uint32_t)( region.Address - end );
+			memset( joined.Extend( (uint32_t)end, gap ), 0xFF, gap );
+			filled += gap;
+		}
+
+		memcpy( joined.Extend( region.Address, region.Size ), region.Data, region.Size );
+		end = (uint64_t)region.Address + region.Size;
+	}
+	if( end & 1 )
+	{
+		*joined.Extend( (uint32_t)end, 1 ) = 0xFF;
+		filled++;
+	}
+
+	*this = move( joined );
+	return true;
+}
+
+bool CirqueFirmwareImage::operator==( const CirqueFirmwareImage& image ) const
+{
+	if( Count() != image.Count() ) return false;
+	for( size_t i = 0; i < Count(); i++ )
+	{
+		CirqueImageRegion a = ( *this )[i], b = image[i];
+		if( a.Address != b.Address || a.Size != b.Size ) return false;
+		// Compare a block at a time, as View may only hold one.
+		for( uint32_t at = 0; at < a.Size; at += 4096 )
+		{
+			uint32_t piece = ( a.Size - at < 4096 ) ? a.Size - at : 4096;
+			const uint8_t *x = View( i, at, piece );
+			const uint8_t *y = x ? image.View( i, at, piece ) : NULL;
+			if( y == NULL || memcmp( x, y, piece ) != 0 ) return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,144 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_FIRMWARE_IMAGE_H__
+#define __CIRQUE_FIRMWARE_IMAGE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// One region of a firmware image: Size bytes to be written at Address.
+// Data points into the image and stays valid until the image changes. It
+// is NULL in a compressed image, whose bytes are read with View.
+// Regions loaded from a binary file carry the FormatRegion checksum for
+// both byte orders, indexed by IS_BIG_ENDIAN.
+struct CirqueImageRegion
+{
+	uint32_t Address;
+	const uint8_t *Data;
+	uint32_t Size;
+	bool HasChecksums;
+	uint32_t Checksums[2];
+};
+
+// A sparse firmware image. The bytes of all regions sit back to back in
+// one arena, each region starting on an 8 byte boundary so it can be read
+// as 16 or 32 bit words, and a region is only an {address, offset, length}
+// entry. Data appended right after the end of the last region extends it.
+// An image can instead point into a read-only file mapping it owns; it is
+// copied into an arena the first time it is changed. A mapping can hold
+// compressed regions, which are only decompressed a block at a time as
+// View asks for them, until the image changes.
+class CirqueFirmwareImage
+{
+	private:
+	struct Descriptor
+	{
+		uint32_t Address;
+		uint32_t Offset;
+		uint32_t Length;
+		bool HasChecksums;
+		uint32_t Checksums[2];
+	};
+
+	static const uint32_t ALIGNMENT = 8;
+
+	vector<uint8_t> arena;
+	vector<Descriptor> regions;
+	size_t bytes = 0;
+	const uint8_t *mapping = NULL;
+	size_t mapping_size = 0;
+	uint32_t block_size = 0;
+
+	// The last block View decompressed, and the bytes it last returned when
+	// they spanned blocks.
+	mutable vector<uint8_t> block;
+	mutable size_t block_region = SIZE_MAX;
+	mutable uint32_t block_index = 0;
+	mutable vector<uint8_t> view;
+
+	const uint8_t* Storage() const { return mapping ? mapping : arena.data(); }
+	bool LoadBlock( size_t i, uint32_t index ) const;
+	void Unmap();
+
+	public:
+	CirqueFirmwareImage() {}
+	CirqueFirmwareImage( CirqueFirmwareImage&& image ) noexcept { *this = move( image ); }
+	CirqueFirmwareImage& operator=( CirqueFirmwareImage&& image ) noexcept;
+	CirqueFirmwareImage( const CirqueFirmwareImage& ) = delete;
+	CirqueFirmwareImage& operator=( const CirqueFirmwareImage& ) = delete;
+	~CirqueFirmwareImage() { Clear(); }
+
+	size_t Count() const { return regions.size(); }
+	bool Empty() const { return regions.empty(); }
+	// Data bytes in all regions.
+	size_t Bytes() const { return bytes; }
+	CirqueImageRegion operator[]( size_t i ) const
+	{
+		const Descriptor& d = regions[i];
+		CirqueImageRegion region = { d.Address, block_size ? NULL : Storage() + d.Offset, d.Length, d.HasChecksums, { d.Checksums[0], d.Checksums[1] } };
+		return region;
+	}
+	// Returns length bytes of region i from offset on. The pointer stays
+	// valid until the next View or change of the image. NULL if the bytes
+	// are compressed and corrupt.
+	const uint8_t* View( size_t i, uint32_t offset, uint32_t length ) const;
+
+	// Reserves room for the given number of data bytes and regions, so
+	// building the image does not move the arena.
+	void Reserve( size_t data_bytes, size_t region_count );
+	// Returns where to store length bytes for address, growing the last
+	// region if address follows it and starting a new region otherwise.
+	uint8_t* Extend( uint32_t address, uint32_t length );
+	// Like Extend, but always starts a new region.
+	uint8_t* AddRegion( uint32_t address, uint32_t length );
+	void Append( uint32_t address, const uint8_t *data, uint32_t length );
+	// Appends the regions of another image, joining its first region to
+	// the last one of this image if they are contiguous.
+	void Append( const CirqueFirmwareImage& image );
+	void Clear();
+
+	// Takes over a read-only mapping of size bytes, which is unmapped with
+	// the image. AddMappedRegion then describes a region inside it. With a
+	// block size, the offset of a region is that of a table of RegionBlocks
+	// + 1 block offsets into the mapping, and each block of the region was
+	// compressed on its own with CirqueLzCodec, or stored as is if that
+	// didn't make it smaller.
+	void Map( const uint8_t *map, size_t size, uint32_t compressed_block_size = 0 );
+	void AddMappedRegion( uint32_t address, uint32_t offset, uint32_t length, uint32_t checksum_little, uint32_t checksum_big );
+	void AddMappedRegion( uint32_t address, uint32_t offset, uint32_t length );
+	bool IsMapped() const { return mapping != NULL; }
+	bool IsCompressed() const { return block_size != 0; }
+	static uint32_t RegionBlocks( uint32_t length, uint32_t block_size ) { return ( length + block_size - 1 ) / block_size; }
+	// Copies a mapped image into an arena, decompressing it if need be.
+	void Expand() { Unmap(); }
+
+	// Sorts the regions by address and joins regions that touch, that
+	// overlap with the same data, or that are at most max_gap bytes apart,
+	// filling the gap with 0xFF. Regions are padded with 0xFF to start and
+	// end on even addresses. Returns false, with the image unchanged
+	// and the first address in dispute in conflict, if regions overlap with
+	// different data. filled returns the number of gap bytes added.
+	bool Coalesce( uint32_t max_gap, uint32_t& conflict, uint32_t& filled );
+
+	bool operator==( const CirqueFirmwareImage& image ) const;
+	bool operator!=( const CirqueFirmwareImage& image ) const { return !( *this == image ); }
+};
+
+#endif //__CIRQUE_FIRMWARE_IMAGE_H__
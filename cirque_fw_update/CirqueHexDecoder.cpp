@@ -0,0 +1,258 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "CirqueHexDecoder.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define HEX_DECODER_X86
+#elif defined( __aarch64__ ) && defined( __ARM_NEON )
+#include <arm_neon.h>
+#define HEX_DECODER_NEON
+#endif
+
+using namespace std;
+
+// Value of each hex digit, -1 for any other character.
+static const int8_t hex_nibble[256] =
+{
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+size_t CirqueHexDecoder::DecodeScalar( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum )
+{
+	size_t i;
+	for( i = 0; i < pairs; i++ )
+	{
+		int hi = hex_nibble[text[2 * i]];
+		int lo = hex_nibble[text[2 * i + 1]];
+		if( ( hi | lo ) < 0 ) break;
+		out[i] = ( hi << 4 ) | lo;
+		sum += out[i];
+	}
+	return i;
+}
+
+#ifdef HEX_DECODER_X86
+
+// In each step, a character is a digit if it lies in '0'..'9' and a letter
+// if, with the lower case bit set, it lies in 'a'..'f'. Its value is its low
+// four bits, plus 9 for letters. The signed compares also reject bytes with
+// the top bit set. Adjacent values are joined in 16 bit lanes, packed to
+// bytes and summed with a SAD against zero.
+static size_t DecodeSse2( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum )
+{
+	const __m128i below_0 = _mm_set1_epi8( '0' - 1 );
+	const __m128i above_9 = _mm_set1_epi8( '9' + 1 );
+	const __m128i below_a = _mm_set1_epi8( 'a' - 1 );
+	const __m128i above_f = _mm_set1_epi8( 'f' + 1 );
+	const __m128i lower = _mm_set1_epi8( 0x20 );
+	const __m128i low_bits = _mm_set1_epi8( 0x0F );
+	const __m128i nine = _mm_set1_epi8( 9 );
+	const __m128i low_byte = _mm_set1_epi16( 0x00FF );
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t total = 0;
+	size_t i = 0;
+
+	for( ; i + 8 <= pairs; i += 8 )
+	{
+		__m128i c = _mm_loadu_si128( (const __m128i*)( text + 2 * i ) );
+		__m128i l = _mm_or_si128( c, lower );
+		__m128i digit = _mm_and_si128( _mm_cmpgt_epi8( c, below_0 ), _mm_cmpgt_epi8( above_9, c ) );
+		__m128i letter = _mm_and_si128( _mm_cmpgt_epi8( l, below_a ), _mm_cmpgt_epi8( above_f, l ) );
+		if( _mm_movemask_epi8( _mm_or_si128( digit, letter ) ) != 0xFFFF ) break;
+
+		__m128i nibbles = _mm_add_epi8( _mm_and_si128( c, low_bits ), _mm_and_si128( letter, nine ) );
+		__m128i words = _mm_or_si128( _mm_slli_epi16( _mm_and_si128( nibbles, low_byte ), 4 ), _mm_srli_epi16( nibbles, 8 ) );
+		__m128i bytes = _mm_packus_epi16( words, zero );
+		_mm_storel_epi64( (__m128i*)( out + i ), bytes );
+		total += _mm_cvtsi128_si32( _mm_sad_epu8( bytes, zero ) );
+	}
+
+	sum += total;
+	return i + CirqueHexDecoder::DecodeScalar( text + 2 * i, pairs - i, out + i, sum );
+}
+
+__attribute__(( target( "avx2" ) ))
+static size_t DecodeAvx2( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum )
+{
+	const __m256i below_0 = _mm256_set1_epi8( '0' - 1 );
+	const __m256i above_9 = _mm256_set1_epi8( '9' + 1 );
+	const __m256i below_a = _mm256_set1_epi8( 'a' - 1 );
+	const __m256i above_f = _mm256_set1_epi8( 'f' + 1 );
+	const __m256i lower = _mm256_set1_epi8( 0x20 );
+	const __m256i low_bits = _mm256_set1_epi8( 0x0F );
+	const __m256i nine = _mm256_set1_epi8( 9 );
+	const __m256i low_byte = _mm256_set1_epi16( 0x00FF );
+	const __m256i zero = _mm256_setzero_si256();
+	uint32_t total = 0;
+	size_t i = 0;
+
+	for( ; i + 16 <= pairs; i += 16 )
+	{
+		__m256i c = _mm256_loadu_si256( (const __m256i*)( text + 2 * i ) );
+		__m256i l = _mm256_or_si256( c, lower );
+		__m256i digit = _mm256_and_si256( _mm256_cmpgt_epi8( c, below_0 ), _mm256_cmpgt_epi8( above_9, c ) );
+		__m256i letter = _mm256_and_si256( _mm256_cmpgt_epi8( l, below_a ), _mm256_cmpgt_epi8( above_f, l ) );
+		if( (uint32_t)_mm256_movemask_epi8( _mm256_or_si256( digit, letter ) ) != 0xFFFFFFFF ) break;
+
+		__m256i nibbles = _mm256_add_epi8( _mm256_and_si256( c, low_bits ), _mm256_and_si256( letter, nine ) );
+		__m256i words = _mm256_or_si256( _mm256_slli_epi16( _mm256_and_si256( nibbles, low_byte ), 4 ), _mm256_srli_epi16( nibbles, 8 ) );
+		// Packing works within each 128 bit half, so gather the two results.
+		__m256i packed = _mm256_permute4x64_epi64( _mm256_packus_epi16( words, zero ), 0x08 );
+		__m128i bytes = _mm256_castsi256_si128( packed );
+		_mm_storeu_si128( (__m128i*)( out + i ), bytes );
+		__m128i sad = _mm_sad_epu8( bytes, _mm_setzero_si128() );
+		total += _mm_cvtsi128_si32( sad ) + _mm_extract_epi16( sad, 4 );
+	}
+
+	sum += total;
+	return i + DecodeSse2( text + 2 * i, pairs - i, out + i, sum );
+}
+
+#endif
+
+#ifdef HEX_DECODER_NEON
+
+// vld2 splits the text into the first and second digit of each pair, so
+// the bytes come straight from the two halves.
+static size_t DecodeNeon( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum )
+{
+	const uint8x16_t lower = vdupq_n_u8( 0x20 );
+	const uint8x16_t low_bits = vdupq_n_u8( 0x0F );
+	const uint8x16_t nine = vdupq_n_u8( 9 );
+	uint32_t total = 0;
+	size_t i = 0;
+
+	for( ; i + 16 <= pairs; i += 16 )
+	{
+		uint8x16x2_t c = vld2q_u8( text + 2 * i );
+		uint8x16_t nibbles[2];
+		uint8x16_t valid = vdupq_n_u8( 0xFF );
+		for( int half = 0; half < 2; half++ )
+		{
+			uint8x16_t l = vorrq_u8( c.val[half], lower );
+			uint8x16_t digit = vandq_u8( vcgeq_u8( c.val[half], vdupq_n_u8( '0' ) ), vcleq_u8( c.val[half], vdupq_n_u8( '9' ) ) );
+			uint8x16_t letter = vandq_u8( vcgeq_u8( l, vdupq_n_u8( 'a' ) ), vcleq_u8( l, vdupq_n_u8( 'f' ) ) );
+			valid = vandq_u8( valid, vorrq_u8( digit, letter ) );
+			nibbles[half] = vaddq_u8( vandq_u8( c.val[half], low_bits ), vandq_u8( letter, nine ) );
+		}
+		if( vminvq_u8( valid ) != 0xFF ) break;
+
+		uint8x16_t bytes = vorrq_u8( vshlq_n_u8( nibbles[0], 4 ), nibbles[1] );
+		vst1q_u8( out + i, bytes );
+		total += vaddlvq_u8( bytes );
+	}
+
+	sum += total;
+	return i + CirqueHexDecoder::DecodeScalar( text + 2 * i, pairs - i, out + i, sum );
+}
+
+#endif
+
+CirqueHexDecoder::DecodeFunction CirqueHexDecoder::Select( const char*& selected_name )
+{
+#if defined( HEX_DECODER_X86 )
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) )
+	{
+		selected_name = "AVX2";
+		return DecodeAvx2;
+	}
+	selected_name = "SSE2";
+	return DecodeSse2;
+#elif defined( HEX_DECODER_NEON )
+	selected_name = "NEON";
+	return DecodeNeon;
+#else
+	selected_name = "scalar";
+	return DecodeScalar;
+#endif
+}
+
+const char* CirqueHexDecoder::name = "scalar";
+CirqueHexDecoder::DecodeFunction CirqueHexDecoder::decode = CirqueHexDecoder::Select( CirqueHexDecoder::name );
+
+// Runs one input through a decoder and the reference, and counts a
+// mismatch in the length, the bytes or the sum.
+static int Compare( CirqueHexDecoder::DecodeFunction f, const vector<uint8_t>& text )
+{
+	size_t pairs = text.size() / 2;
+	vector<uint8_t> expected( pairs + 1 ), actual( pairs + 1 );
+	uint8_t expected_sum = 0x5A, actual_sum = 0x5A;
+	size_t expected_count = CirqueHexDecoder::DecodeScalar( &text[0], pairs, &expected[0], expected_sum );
+	size_t actual_count = f( &text[0], pairs, &actual[0], actual_sum );
+	if( expected_count != actual_count || expected_sum != actual_sum ) return 1;
+	return memcmp( &expected[0], &actual[0], expected_count ) != 0;
+}
+
+int CirqueHexDecoder::SelfCheck()
+{
+	static const char digits[] = "0123456789ABCDEFabcdef";
+	vector<DecodeFunction> decoders;
+	decoders.push_back( decode );
+#ifdef HEX_DECODER_X86
+	decoders.push_back( DecodeSse2 );
+#endif
+	int mismatches = 0;
+	vector<uint8_t> text( 2 * 40 );
+
+	for( size_t d = 0; d < decoders.size(); d++ )
+	{
+		// Every byte value at every position of the first 32 pairs, so
+		// each lane of the widest vector sees each character.
+		for( size_t position = 0; position < 64; position++ )
+		{
+			for( int c = 0; c < 256; c++ )
+			{
+				for( size_t i = 0; i < text.size(); i++ ) text[i] = digits[( i * 7 + c ) % 22];
+				text[position] = c;
+				mismatches += Compare( decoders[d], text );
+			}
+		}
+
+		// Random runs of digits of every length, ending in random bytes.
+		srand( 1 );
+		for( int run = 0; run < 20000; run++ )
+		{
+			vector<uint8_t> random( rand() % 160 );
+			for( size_t i = 0; i < random.size(); i++ )
+				random[i] = ( rand() % 64 ) ? digits[rand() % 22] : rand() % 256;
+			random.push_back( '\r' );
+			random.push_back( '\n' );
+			mismatches += Compare( decoders[d], random );
+		}
+	}
+	return mismatches;
+}
@@ -0,0 +1,52 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_HEX_DECODER_H__
+#define __CIRQUE_HEX_DECODER_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// Converts pairs of hex digits to bytes. Decoding stops at the first pair
+// that holds anything other than a hex digit, so the count returned is the
+// length of the record on a line. Every byte decoded is added to sum, which
+// is zero (mod 256) after a record whose checksum is right.
+//
+// Decode uses the widest vector unit the processor has: AVX2 or SSE2 on
+// x86-64, NEON on AArch64, a lookup table elsewhere. DecodeScalar is the
+// lookup table version, kept as the reference the others must match.
+class CirqueHexDecoder
+{
+	public:
+	typedef size_t ( *DecodeFunction )( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum );
+
+	static size_t Decode( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum )
+	{
+		return decode( text, pairs, out, sum );
+	}
+	static size_t DecodeScalar( const uint8_t *text, size_t pairs, uint8_t *out, uint8_t& sum );
+	static const char* Name() { return name; }
+	// Compares Decode with DecodeScalar on every character in every lane
+	// position and on random text. Returns the number of mismatches.
+	static int SelfCheck();
+
+	private:
+	static DecodeFunction decode;
+	static const char* name;
+	static DecodeFunction Select( const char*& selected_name );
+};
+
+#endif //__CIRQUE_HEX_DECODER_H__
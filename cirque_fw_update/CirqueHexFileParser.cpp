@@ -1,202 +1,938 @@
-/*
-Copyright 2019 Cirque Corporation
-
-Licensed under the Apache License, Version 2.0 (the "License");
-you may not use this file except in compliance with the License.
-You may obtain a copy of the License at
-
-    http://www.apache.org/licenses/LICENSE-2.0
-
-Unless required by applicable law or agreed to in writing, software
-distributed under the License is distributed on an "AS IS" BASIS,
-WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-See the License for the specific language governing permissions and
-limitations under the License.
-*/
-
-#include <fstream>
-#include "CirqueHexFileParser.h"
-
-CirqueHexFileParser::CirqueHexFileParser( string& Filename )
-{
-	filename = Filename;
-	// Check the file signature.
-	char buffer[7] = { 0 };
-	ifstream file(filename, ios::binary | ios::in);
-	if (file.is_open() && file.read(buffer, 6) && string(buffer) == "Cirque")
-	{
-		// We have a preparsed binary file. Set the flag to treat it accordingly.
-		bin = true;
-		file.close();
-	}
-}
-
-CirqueHexFileParser::~CirqueHexFileParser()
-{
-	for( unsigned i = 0; i < recList.size(); ++i )
-		delete recList[i];
-}
-
-int CirqueHexFileParser::Parse()
-{
-	// If the firmware file is preparsed, skip parsing and read the records.
-	if (bin) return ReadBin();
-
-	string str;
-	ifstream file( filename );
-	printf("Parsing %s (stream %d)\n", filename.c_str(), file.is_open());
-	if( !file.is_open() ) return HEX_NOFILE;
-	while( getline( file, str ) )
-	{
-		if( done )
-			break;
-
-		rec = new CirqueHexFileRecord( str );
-
-		if( rec->isValid() )
-		{
-			switch( rec->getRecordType() )
-			{
-				case rt_data:
-					if( !recList.empty() && recList.back()->merge( rec ) )
-						delete rec;
-					else
-						recList.push_back( rec );
-					break;
-				case rt_end_of_file:
-					delete rec;
-					done = true;
-					break;
-				case rt_extended_segment_address:
-					delete rec;
-					break;
-				case rt_start_segment_address:
-					startSegmentAddress = rec->getAddress();
-					delete rec;
-					break;
-				case rt_extended_linear_address:
-					delete rec;
-					break;
-				case rt_start_linear_address:
-					startLinearAddress = rec->getAddress();
-					delete rec;
-					break;
-			}
-			// Debug
-			// printf( "%s\n", str.c_str() );
-		}
-		else
-		{
-			delete rec;
-			return HEX_CORRUPT;
-		}
-	}
-	return HEX_SUCCESS;
-}
-
-int CirqueHexFileParser::WriteBin(string& Filename)
-{
-	ofstream file(Filename, ios::binary | ios::out);
-	if (file.is_open() && recList.size() > 0)
-	{
-		// Write the header.
-		file.write("Cirque\0\0", 8);
-		// Write record count.
-		uint32_t temp = recList.size();
-		file.write((char*)&temp, 4);
-		// Write records one by one.
-		for (int i = 0; i < recList.size(); i++)
-		{
-			// Write the address for the record.
-			temp = recList[i]->getAddress();
-			file.write((char*)&temp, 4);
-			// Write the length of the record.
-			temp = recList[i]->getSize();
-			file.write((char*)&temp, 4);
-			// Write the data.
-			file.write((char*)recList[i]->buf.data(), recList[i]->buf.size());
-			// Write checksum.
-			temp = Fletcher_32((uint16_t*)recList[i]->buf.data(), recList[i]->buf.size());
-			file.write((char*)&temp, 4);
-		}
-		file.close();
-	}
-	return HEX_SUCCESS;
-}
-
-int CirqueHexFileParser::ReadBin()
-{
-	ifstream file(filename, ios::binary | ios::in);
-	if (!file.is_open()) return HEX_NOFILE;
-	// Check the file signature.
-	char buffer[7] = { 0 };
-	if (file.read(buffer, 6) && string(buffer) == "Cirque")
-	{
-		// Get the binary format version.
-		uint16_t version = 0;
-		if (file.read((char*)&version, 2))
-		{
-			if (version == 0)
-			{
-				// Read record count.
-				uint32_t count = 0;
-				file.read((char*)&count, 4);
-				for (int i = 0; i < count; i++)
-				{
-					// Create a record object.
-					rec = new CirqueHexFileRecord();
-					// Set record address.
-					file.read((char*)&rec->address, 4);
-					// Read record length.
-					uint32_t temp = 0;
-					file.read((char*)&temp, 4);
-					// Read data.
-					uint8_t* buffer = new uint8_t[temp];
-					file.read((char*)buffer, temp);
-					rec->buf.assign(buffer, buffer + temp);
-					delete[] buffer;
-					// Read checksum.
-					file.read((char*)&temp, 4);
-					if (temp == Fletcher_32((uint16_t*)rec->buf.data(), rec->buf.size()))
-					{
-						recList.push_back(rec);
-					}
-					else
-					{
-						delete rec;
-						return HEX_CORRUPT;
-					}
-				}
-			}
-		}
-		file.close();
-	}
-
-	return HEX_SUCCESS;
-}
-
-uint32_t CirqueHexFileParser::Fletcher_32(uint16_t *dataPtr, size_t bytes)
-{
-	uint32_t sum1 = 0xffff;
-	uint32_t sum2 = 0xffff;
-	uint16_t data = 0;
-
-	while (bytes)
-	{
-		uint16_t tlen = bytes > 360 ? 360 : bytes;
-		bytes -= tlen;
-		do
-		{
-			data = *dataPtr++;
-			sum2 += sum1 += data;
-		} while (tlen -= sizeof(uint16_t));
-		sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-		sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-	}
-
-	// Second reduction step to reduce sums to 16 bits
-	sum1 = (sum1 & 0xffff) + (sum1 >> 16);
-	sum2 = (sum2 & 0xffff) + (sum2 >> 16);
-	return sum2 << 16 | sum1;
-}
-
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <elf.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "CirqueHexFileParser.h"
+#include "CirqueHexDecoder.h"
+#include "CirqueBootloaderCollection.h"
+#include "CirqueLzCodec.h"
+
+// Version 1 binary files, all fields little-endian:
+//   header            CirqueBinHeader
+//   table of contents RegionCount x CirqueBinRegion, at HeaderSize
+//   region payloads   each at a multiple of PageSize from the file start
+// Checksums are the FormatRegion Fletcher-32 for each device byte order.
+// Version 2 files are the same, except that PageSize is the block size
+// of CirqueFirmwareImage::Map, a region's Offset is that of its block
+// table, and the block tables and blocks follow the table of contents
+// with no padding.
+#define BIN_HAS_VERSION 0x0001
+#define BIN_HAS_REV     0x0002
+#define BIN_HAS_TOC_CHECKSUM 0x0004
+
+struct CirqueBinHeader
+{
+	char Signature[6];
+	uint16_t Version;
+	uint32_t HeaderSize;
+	uint32_t PageSize;
+	uint32_t RegionCount;
+	uint32_t Flags;
+	uint16_t VID;
+	uint16_t PID;
+	uint16_t VER;
+	uint16_t ByteOrder;
+	uint32_t REV;
+	uint32_t EntryPoint;
+	uint32_t FileSize;
+	uint32_t TocChecksum;
+	uint8_t Reserved[16];
+};
+
+struct CirqueBinRegion
+{
+	uint32_t Address;
+	uint32_t Offset;
+	uint32_t Length;
+	uint32_t ChecksumLittle;
+	uint32_t ChecksumBig;
+};
+
+static_assert( sizeof( CirqueBinHeader ) == 64, "binary header layout" );
+static_assert( sizeof( CirqueBinRegion ) == 20, "binary region layout" );
+
+CirqueHexFileParser::CirqueHexFileParser( string& Filename )
+{
+	filename = Filename;
+	// Check the file signature.
+	char buffer[7] = { 0 };
+	ifstream file(filename, ios::binary | ios::in);
+	if (file.is_open() && file.read(buffer, 6) && string(buffer) == "Cirque")
+	{
+		// We have a preparsed binary file. Set the flag to treat it accordingly.
+		bin = true;
+		file.close();
+	}
+	else if (memcmp(buffer, ELFMAG, SELFMAG) == 0)
+	{
+		elf = true;
+	}
+}
+
+CirqueHexFileParser::~CirqueHexFileParser()
+{
+}
+
+int CirqueHexFileParser::Parse()
+{
+	int retval;
+	FromCache = false;
+
+	// Cached images were coalesced before they were stored.
+	if (!bin && !elf && !CachePath.empty())
+	{
+		retval = ReadBinMapped(CachePath);
+		if (retval == HEX_SUCCESS)
+		{
+			printf("Loaded %s from the image cache.\n", filename.c_str());
+			FromCache = true;
+			return HEX_SUCCESS;
+		}
+		if (retval != HEX_NOFILE)
+			printf("The cached image of %s is corrupted, parsing the file again.\n", filename.c_str());
+	}
+
+	// If the firmware file is preparsed, skip parsing and read the records.
+	if (bin)
+		retval = ReadBin();
+	else if (elf)
+		retval = ReadElf();
+	else
+		retval = ParseHex();
+
+	if (retval == HEX_SUCCESS) retval = CoalesceRegions();
+	if (retval == HEX_SUCCESS && !bin && !elf && !CachePath.empty() && WriteBin(CachePath) != HEX_SUCCESS)
+		printf("Could not write %s to the image cache.\n", filename.c_str());
+	return retval;
+}
+
+int CirqueHexFileParser::ParseHex()
+{
+	printf("Parsing %s\n", filename.c_str());
+	unsigned threads = ParseThreads;
+	if( threads == 0 )
+	{
+		struct stat st;
+		threads = 1;
+		if( stat( filename.c_str(), &st ) == 0 )
+			threads = min<uint64_t>( thread::hardware_concurrency(), st.st_size / HEX_PARSE_CHUNK_MIN );
+	}
+	if( threads > 1 ) return ParseParallel( threads );
+	return ParseMapped();
+}
+
+// Records may come in any order and with padding left out, and every
+// region costs the device a FormatRegion. Sort the regions and join those
+// that touch, or that are at most MaxGapFill bytes apart.
+int CirqueHexFileParser::CoalesceRegions()
+{
+	size_t count = Image.Count();
+	uint32_t conflict = 0, filled = 0;
+	if( !Image.Coalesce( MaxGapFill, conflict, filled ) )
+	{
+		printf( "Records overlap with different data at 0x%08X.\n", conflict );
+		return HEX_OVERLAP;
+	}
+	if( Image.Count() != count )
+		printf( "Joined %d regions into %d, filling %d bytes of gaps.\n", (int)count, (int)Image.Count(), filled );
+	if( Image.Count() > HEX_MAX_REGIONS )
+	{
+		printf( "The image has %d regions, the bootloader takes at most %d.\n", (int)Image.Count(), HEX_MAX_REGIONS );
+		return HEX_TOO_MANY_REGIONS;
+	}
+	return HEX_SUCCESS;
+}
+
+// Maps the whole file read-only. Returns HEX_SUCCESS with a NULL mapping
+// for an empty file.
+static int MapFile( const string& filename, const uint8_t*& map, size_t& size )
+{
+	map = NULL;
+	size = 0;
+	int fd = open( filename.c_str(), O_RDONLY );
+	if( fd == -1 ) return HEX_NOFILE;
+
+	struct stat st;
+	if( fstat( fd, &st ) != 0 )
+	{
+		close( fd );
+		return HEX_NOFILE;
+	}
+	if( st.st_size == 0 )
+	{
+		close( fd );
+		return HEX_SUCCESS;
+	}
+
+	void *addr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if( addr == MAP_FAILED ) return HEX_NOFILE;
+	map = (const uint8_t*)addr;
+	size = st.st_size;
+	return HEX_SUCCESS;
+}
+
+// Decodes the lines of one chunk into the chunk's image, starting from the
+// address base the chunk holds.
+void CirqueHexFileParser::ParseChunk( CirqueHexChunk& chunk )
+{
+	const uint8_t *p = chunk.Begin;
+	const uint8_t *end = chunk.End;
+	vector<uint8_t> bytes( 256 );
+
+	while( p < end && !chunk.Done )
+	{
+		const uint8_t *line = p;
+		const uint8_t *eol = (const uint8_t*)memchr( p, '\n', end - p );
+		if( eol == NULL ) eol = end;
+		p = eol + 1;
+
+		// Comments, such as the version.
+		if( *line == ';' ) continue;
+		if( *line != ':' )
+		{
+			chunk.Result = HEX_CORRUPT;
+			break;
+		}
+
+		// Like the line parser, take the record length from the hex digits
+		// on the line rather than from the byte count.
+		size_t pairs = ( eol - line - 1 ) / 2;
+		if( bytes.size() < pairs ) bytes.resize( pairs );
+		uint8_t sum = 0;
+		uint32_t count = CirqueHexDecoder::Decode( line + 1, pairs, &bytes[0], sum );
+		if( count < 5 || sum != 0 )
+		{
+			chunk.Result = HEX_CORRUPT;
+			break;
+		}
+
+		uint8_t type = bytes[3];
+		uint32_t data_count = count - 5;
+		const uint8_t *data = &bytes[4];
+		uint32_t address = ( ( bytes[1] << 8 ) | bytes[2] ) + chunk.Base.Segment + chunk.Base.Extended;
+
+		if( type == rt_data ) chunk.Image.Append( address, data, data_count );
+
+		switch( type )
+		{
+			case rt_end_of_file:
+				chunk.Done = true;
+				break;
+			case rt_extended_segment_address:
+				if( data_count >= 2 ) chunk.Base.Segment = ( ( data[0] << 8 ) | data[1] ) * 16;
+				break;
+			case rt_start_segment_address:
+				chunk.StartSegmentAddress = address;
+				chunk.HasStartSegmentAddress = true;
+				break;
+			case rt_extended_linear_address:
+				if( data_count >= 2 ) chunk.Base.Extended = ( ( data[0] << 8 ) | data[1] ) << 16;
+				break;
+			case rt_start_linear_address:
+				chunk.StartLinearAddress = address;
+				chunk.HasStartLinearAddress = true;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+// Finds the last extended segment and extended linear address records of a
+// chunk without decoding the rest. Only the type digits of each line are
+// read; a record that is corrupt fails the decode later anyway.
+void CirqueHexFileParser::ScanChunk( CirqueHexChunk& chunk )
+{
+	const uint8_t *p = chunk.Begin;
+	const uint8_t *end = chunk.End;
+
+	while( p < end )
+	{
+		const uint8_t *line = p;
+		const uint8_t *eol = (const uint8_t*)memchr( p, '\n', end - p );
+		if( eol == NULL ) eol = end;
+		p = eol + 1;
+
+		if( eol - line < 9 || line[0] != ':' || line[7] != '0' ) continue;
+		if( line[8] != '0' + rt_extended_segment_address && line[8] != '0' + rt_extended_linear_address ) continue;
+
+		uint8_t bytes[7];
+		uint8_t sum = 0;
+		size_t pairs = ( eol - line - 1 ) / 2;
+		uint32_t count = CirqueHexDecoder::Decode( line + 1, pairs < 7 ? pairs : 7, bytes, sum );
+		if( count < 7 ) continue;
+		if( bytes[3] == rt_extended_segment_address )
+		{
+			chunk.Last.Segment = ( ( bytes[4] << 8 ) | bytes[5] ) * 16;
+			chunk.HasSegment = true;
+		}
+		else
+		{
+			chunk.Last.Extended = ( ( bytes[4] << 8 ) | bytes[5] ) << 16;
+			chunk.HasExtended = true;
+		}
+	}
+}
+
+// Appends the images of the chunks in file order, up to the end of file
+// record or the first error. A chunk's first region joins the previous one
+// where the serial parse would have extended it.
+int CirqueHexFileParser::MergeChunks( vector<CirqueHexChunk>& chunks )
+{
+	int retval = HEX_SUCCESS;
+	size_t bytes = 0, regions = 0;
+	for( size_t i = 0; i < chunks.size(); i++ )
+	{
+		bytes += chunks[i].Image.Bytes();
+		regions += chunks[i].Image.Count();
+	}
+
+	for( size_t i = 0; i < chunks.size() && !done; i++ )
+	{
+		CirqueHexChunk& chunk = chunks[i];
+		if( Image.Empty() )
+		{
+			Image = move( chunk.Image );
+			Image.Reserve( bytes - Image.Bytes(), regions - Image.Count() );
+		}
+		else
+		{
+			Image.Append( chunk.Image );
+		}
+		chunk.Image.Clear();
+		if( chunk.HasStartSegmentAddress ) startSegmentAddress = chunk.StartSegmentAddress;
+		if( chunk.HasStartLinearAddress ) startLinearAddress = chunk.StartLinearAddress;
+		done = chunk.Done;
+		if( chunk.Result != HEX_SUCCESS )
+		{
+			retval = chunk.Result;
+			break;
+		}
+	}
+	return retval;
+}
+
+// Decodes the file in one pass over a read-only mapping.
+int CirqueHexFileParser::ParseMapped()
+{
+	const uint8_t *map;
+	size_t size;
+	int retval = MapFile( filename, map, size );
+	if( retval != HEX_SUCCESS || map == NULL ) return retval;
+	madvise( (void*)map, size, MADV_SEQUENTIAL );
+
+	vector<CirqueHexChunk> chunks( 1 );
+	chunks[0].Begin = map;
+	chunks[0].End = map + size;
+	// Each data byte takes two characters, so this is enough for the whole image.
+	chunks[0].Image.Reserve( size / 2, 0 );
+	ParseChunk( chunks[0] );
+	retval = MergeChunks( chunks );
+
+	munmap( (void*)map, size );
+	return retval;
+}
+
+// Splits the mapping at line boundaries into one chunk per thread. A scan
+// of every chunk for address records, in parallel, gives the address base
+// each chunk starts from; then the chunks are decoded in parallel and their
+// regions merged in file order, which gives the same records as ParseMapped.
+int CirqueHexFileParser::ParseParallel( unsigned threads )
+{
+	const uint8_t *map;
+	size_t size;
+	int retval = MapFile( filename, map, size );
+	if( retval != HEX_SUCCESS || map == NULL ) return retval;
+	madvise( (void*)map, size, MADV_WILLNEED );
+
+	if( threads == 0 ) threads = 1;
+	vector<CirqueHexChunk> chunks;
+	const uint8_t *begin = map;
+	const uint8_t *end = map + size;
+	for( unsigned i = 1; i <= threads && begin < end; i++ )
+	{
+		const uint8_t *split = end;
+		if( i < threads )
+		{
+			split = map + size / threads * i;
+			if( split < begin ) split = begin;
+			split = (const uint8_t*)memchr( split, '\n', end - split );
+			split = split ? split + 1 : end;
+		}
+		if( split == begin ) continue;
+		chunks.push_back( CirqueHexChunk() );
+		chunks.back().Begin = begin;
+		chunks.back().End = split;
+		begin = split;
+	}
+
+	vector<thread> pool;
+	for( size_t i = 1; i < chunks.size(); i++ )
+		pool.push_back( thread( ScanChunk, ref( chunks[i - 1] ) ) );
+	for( size_t i = 0; i < pool.size(); i++ ) pool[i].join();
+	pool.clear();
+
+	for( size_t i = 1; i < chunks.size(); i++ )
+	{
+		CirqueHexChunk& previous = chunks[i - 1];
+		chunks[i].Base.Segment = previous.HasSegment ? previous.Last.Segment : previous.Base.Segment;
+		chunks[i].Base.Extended = previous.HasExtended ? previous.Last.Extended : previous.Base.Extended;
+	}
+
+	for( size_t i = 0; i < chunks.size(); i++ )
+		chunks[i].Image.Reserve( ( chunks[i].End - chunks[i].Begin ) / 2, 0 );
+	for( size_t i = 1; i < chunks.size(); i++ )
+		pool.push_back( thread( ParseChunk, ref( chunks[i] ) ) );
+	ParseChunk( chunks[0] );
+	for( size_t i = 0; i < pool.size(); i++ ) pool[i].join();
+	retval = MergeChunks( chunks );
+
+	munmap( (void*)map, size );
+	return retval;
+}
+
+// The records of a run of consecutive lines that extend each other, and
+// the first bytes of their data.
+struct CirqueHexRun
+{
+	uint32_t Address;
+	uint32_t Length;
+	const uint8_t *Line;
+	CirqueHexAddressBase Base;
+	uint8_t Head[8];
+};
+
+// Decodes the data of a run ScanLayout has already checked.
+static void ReadRun( const CirqueHexRun& run, const uint8_t *end, vector<uint8_t>& data )
+{
+	vector<uint8_t> bytes( 256 );
+	data.clear();
+	for( const uint8_t *p = run.Line; p < end && data.size() < run.Length; )
+	{
+		const uint8_t *line = p;
+		const uint8_t *eol = (const uint8_t*)memchr( p, '\n', end - p );
+		if( eol == NULL ) eol = end;
+		p = eol + 1;
+
+		if( *line == ';' ) continue;
+		size_t pairs = ( eol - line - 1 ) / 2;
+		if( bytes.size() < pairs ) bytes.resize( pairs );
+		uint8_t sum = 0;
+		uint32_t data_count = CirqueHexDecoder::Decode( line + 1, pairs, &bytes[0], sum ) - 5;
+		if( bytes[3] == rt_data ) data.insert( data.end(), &bytes[4], &bytes[4] + data_count );
+	}
+}
+
+// Checks every record as ParseChunk does, but only keeps the address and
+// length of the data, to find the regions ParseHex and CoalesceRegions
+// will give the image. Returns HEX_CORRUPT for a file Parse would reject
+// as corrupt, or whose entry point isn't in one run of records,
+// HEX_OVERLAP if runs overlap with different data, and
+// HEX_TOO_MANY_REGIONS if the device can't take the regions.
+int CirqueHexFileParser::ScanLayout( CirqueImageLayout& Layout )
+{
+	const uint8_t *map;
+	size_t size;
+	int retval = MapFile( filename, map, size );
+	if( retval != HEX_SUCCESS ) return retval;
+	if( map == NULL ) return HEX_CORRUPT;
+
+	vector<CirqueHexRun> runs;
+	CirqueHexAddressBase base;
+	vector<uint8_t> bytes( 256 );
+	const uint8_t *p = map, *end = map + size;
+	bool eof = false;
+	while( p < end && !eof )
+	{
+		const uint8_t *line = p;
+		const uint8_t *eol = (const uint8_t*)memchr( p, '\n', end - p );
+		if( eol == NULL ) eol = end;
+		p = eol + 1;
+
+		if( *line == ';' ) continue;
+		size_t pairs = ( eol - line - 1 ) / 2;
+		if( bytes.size() < pairs ) bytes.resize( pairs );
+		uint8_t sum = 0;
+		uint32_t count = ( *line == ':' ) ? CirqueHexDecoder::Decode( line + 1, pairs, &bytes[0], sum ) : 0;
+		if( count < 5 || sum != 0 )
+		{
+			retval = HEX_CORRUPT;
+			break;
+		}
+
+		uint32_t data_count = count - 5;
+		const uint8_t *data = &bytes[4];
+		uint32_t address = ( ( bytes[1] << 8 ) | bytes[2] ) + base.Segment + base.Extended;
+		switch( bytes[3] )
+		{
+			case rt_data:
+				if( data_count == 0 ) break;
+				if( runs.empty() || runs.back().Address + runs.back().Length != address )
+				{
+					CirqueHexRun run = { address, 0, line, base, {} };
+					runs.push_back( run );
+				}
+				if( runs.back().Length < 8 )
+					memcpy( runs.back().Head + runs.back().Length, data, min<uint32_t>( data_count, 8 - runs.back().Length ) );
+				runs.back().Length += data_count;
+				break;
+			case rt_end_of_file:
+				eof = true;
+				break;
+			case rt_extended_segment_address:
+				if( data_count >= 2 ) base.Segment = ( ( data[0] << 8 ) | data[1] ) * 16;
+				break;
+			case rt_extended_linear_address:
+				if( data_count >= 2 ) base.Extended = ( ( data[0] << 8 ) | data[1] ) << 16;
+				break;
+			default:
+				break;
+		}
+	}
+	if( retval == HEX_SUCCESS && runs.empty() ) retval = HEX_CORRUPT;
+
+	// Join the runs as CirqueFirmwareImage::Coalesce joins regions. That
+	// fails if any two runs overlap with different data, so the data of
+	// overlapping runs is decoded to compare them.
+	stable_sort( runs.begin(), runs.end(), []( const CirqueHexRun& a, const CirqueHexRun& b ) { return a.Address < b.Address; } );
+	Layout.RegionCount = 0;
+	uint64_t region_end = 0;
+	vector<vector<uint8_t>> data( runs.size() );
+	for( size_t i = 0; i < runs.size() && retval == HEX_SUCCESS; i++ )
+	{
+		for( size_t j = 0; j < i && runs[i].Address < region_end && retval == HEX_SUCCESS; j++ )
+		{
+			uint64_t overlap_end = min( (uint64_t)runs[i].Address + runs[i].Length, (uint64_t)runs[j].Address + runs[j].Length );
+			if( overlap_end <= runs[i].Address ) continue;
+			if( data[i].empty() ) ReadRun( runs[i], end, data[i] );
+			if( data[j].empty() ) ReadRun( runs[j], end, data[j] );
+			if( memcmp( &data[i][0], &data[j][runs[i].Address - runs[j].Address], overlap_end - runs[i].Address ) != 0 ) retval = HEX_OVERLAP;
+		}
+		if( Layout.RegionCount == 0 || ( runs[i].Address & ~1u ) > ( ( region_end + 1 ) & ~1ull ) + MaxGapFill ) Layout.RegionCount++;
+		region_end = max( region_end, (uint64_t)runs[i].Address + runs[i].Length );
+	}
+	munmap( (void*)map, size );
+	if( retval != HEX_SUCCESS ) return retval;
+	if( Layout.RegionCount > HEX_MAX_REGIONS ) return HEX_TOO_MANY_REGIONS;
+
+	// The entry point is the second word of the first region.
+	if( runs[0].Length < 8 || ( runs[0].Address & 1 ) ) return HEX_CORRUPT;
+	const uint8_t *entry = runs[0].Head;
+	Layout.EntryPoint = entry[4] | ( entry[5] << 8 ) | ( entry[6] << 16 ) | ( (uint32_t)entry[7] << 24 );
+	return HEX_SUCCESS;
+}
+
+int CirqueHexFileParser::ParseLines()
+{
+	string str;
+	CirqueHexAddressBase base;
+	ifstream file( filename );
+	if( !file.is_open() ) return HEX_NOFILE;
+	while( getline( file, str ) )
+	{
+		if( done )
+			break;
+		// Comments, such as the version.
+		if( !str.empty() && str[0] == ';' )
+			continue;
+
+		CirqueHexFileRecord* rec = new CirqueHexFileRecord( str, base );
+
+		if( rec->isValid() )
+		{
+			switch( rec->getRecordType() )
+			{
+				case rt_data:
+					Image.Append( rec->getAddress(), rec->buf.data(), rec->getSize() );
+					delete rec;
+					break;
+				case rt_end_of_file:
+					delete rec;
+					done = true;
+					break;
+				case rt_extended_segment_address:
+					delete rec;
+					break;
+				case rt_start_segment_address:
+					startSegmentAddress = rec->getAddress();
+					delete rec;
+					break;
+				case rt_extended_linear_address:
+					delete rec;
+					break;
+				case rt_start_linear_address:
+					startLinearAddress = rec->getAddress();
+					delete rec;
+					break;
+			}
+			// Debug
+			// printf( "%s\n", str.c_str() );
+		}
+		else
+		{
+			delete rec;
+			return HEX_CORRUPT;
+		}
+	}
+	return HEX_SUCCESS;
+}
+
+int CirqueHexFileParser::ReadVersion( CirqueFirmwareVersion& Version )
+{
+	// Only version 1 and 2 binary files carry a version.
+	if (bin)
+	{
+		CirqueBinHeader header;
+		ifstream file(filename, ios::binary | ios::in);
+		if (!file.is_open()) return HEX_NOFILE;
+		if (!file.read((char*)&header, sizeof(header)) || (header.Version != 1 && header.Version != BIN_COMPRESSED_VERSION) || !(header.Flags & BIN_HAS_VERSION))
+			return HEX_NOVERSION;
+		Version.VID = header.VID;
+		Version.PID = header.PID;
+		Version.VER = header.VER;
+		Version.REV = header.REV;
+		Version.HasREV = (header.Flags & BIN_HAS_REV) != 0;
+		return HEX_SUCCESS;
+	}
+	if (elf) return HEX_NOVERSION;
+
+	string str;
+	CirqueHexAddressBase base;
+	ifstream file( filename );
+	if( !file.is_open() ) return HEX_NOFILE;
+
+	// The version comment comes before the first record.
+	int found = 0;
+	while( getline( file, str ) && !str.empty() && str[0] == ';' )
+	{
+		if( str.compare( 0, 7, ";CIRQUE" ) != 0 ) continue;
+
+		istringstream fields( str.substr( 7 ) );
+		string field;
+		while( fields >> field )
+		{
+			size_t equals = field.find( '=' );
+			if( equals == string::npos ) continue;
+			string key = field.substr( 0, equals );
+			uint32_t value = strtoul( field.c_str() + equals + 1, NULL, 16 );
+
+			if( key == "VID" ) { Version.VID = value; found |= 1; }
+			else if( key == "PID" ) { Version.PID = value; found |= 2; }
+			else if( key == "VER" ) { Version.VER = value; found |= 4; }
+			else if( key == "REV" ) { Version.REV = value; Version.HasREV = true; }
+		}
+	}
+
+	return ( found == 7 ) ? HEX_SUCCESS : HEX_NOVERSION;
+}
+
+// Writes to a temporary file that replaces the target at the end, so a
+// mapped source file can be converted in place. Targets that aren't
+// regular files, like a pipe or /dev/null, are written directly.
+int CirqueHexFileParser::WriteBin(string& Filename, bool Compress)
+{
+	if (Image.Empty()) return HEX_CORRUPT;
+	if (Image.IsCompressed()) Image.Expand();
+
+	CirqueFirmwareVersion version;
+	bool has_version = ReadVersion(version) == HEX_SUCCESS;
+
+	CirqueBinHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Signature, "Cirque", 6);
+	header.Version = Compress ? BIN_COMPRESSED_VERSION : BIN_VERSION;
+	header.HeaderSize = sizeof(header);
+	header.PageSize = Compress ? BIN_BLOCK_SIZE : BIN_PAGE_SIZE;
+	header.RegionCount = Image.Count();
+	if (has_version)
+	{
+		header.Flags = BIN_HAS_VERSION | (version.HasREV ? BIN_HAS_REV : 0);
+		header.VID = version.VID;
+		header.PID = version.PID;
+		header.VER = version.VER;
+		header.REV = version.REV;
+	}
+	header.ByteOrder = ByteOrder;
+	CirqueImageRegion first = Image[0];
+	if (first.Size >= 8)
+		header.EntryPoint = first.Data[4] | (first.Data[5] << 8) | (first.Data[6] << 16) | (first.Data[7] << 24);
+
+	// Compressed regions are a block table and the blocks, each block kept
+	// as is if compressing doesn't make it smaller.
+	vector<vector<uint8_t>> payloads(Compress ? Image.Count() : 0);
+	for (size_t i = 0; i < payloads.size(); i++)
+	{
+		CirqueImageRegion region = Image[i];
+		uint32_t blocks = CirqueFirmwareImage::RegionBlocks(region.Size, BIN_BLOCK_SIZE);
+		vector<uint8_t>& payload = payloads[i];
+		vector<uint32_t> table(blocks + 1);
+		payload.resize(table.size() * sizeof(uint32_t));
+		vector<uint8_t> compressed(CirqueLzCodec::Bound(BIN_BLOCK_SIZE));
+		for (uint32_t j = 0; j < blocks; j++)
+		{
+			uint32_t at = j * BIN_BLOCK_SIZE;
+			uint32_t length = (region.Size - at < BIN_BLOCK_SIZE) ? region.Size - at : BIN_BLOCK_SIZE;
+			uint32_t stored = CirqueLzCodec::Compress(region.Data + at, length, compressed.data());
+			table[j] = (uint32_t)payload.size();
+			if (stored < length)
+				payload.insert(payload.end(), compressed.begin(), compressed.begin() + stored);
+			else
+				payload.insert(payload.end(), region.Data + at, region.Data + at + length);
+		}
+		table[blocks] = (uint32_t)payload.size();
+		memcpy(payload.data(), table.data(), table.size() * sizeof(uint32_t));
+	}
+
+	// Regions follow the table of contents, each on a page boundary unless
+	// compressed.
+	vector<CirqueBinRegion> toc(Image.Count());
+	uint64_t offset = sizeof(header) + toc.size() * sizeof(CirqueBinRegion);
+	for (size_t i = 0; i < Image.Count(); i++)
+	{
+		CirqueImageRegion region = Image[i];
+		if (!Compress) offset = (offset + BIN_PAGE_SIZE - 1) & ~(uint64_t)(BIN_PAGE_SIZE - 1);
+		toc[i].Address = region.Address;
+		toc[i].Offset = (uint32_t)offset;
+		toc[i].Length = region.Size;
+		toc[i].ChecksumLittle = region.HasChecksums ? region.Checksums[0] : CirqueBootloaderCollection::Fletcher_32(region.Data, region.Size, 0);
+		toc[i].ChecksumBig = region.HasChecksums ? region.Checksums[1] : CirqueBootloaderCollection::Fletcher_32(region.Data, region.Size, 1);
+		offset += Compress ? payloads[i].size() : region.Size;
+		if (offset > UINT32_MAX) return HEX_CORRUPT;
+	}
+
+	// Block tables hold offsets from the start of their region, until the
+	// region's place in the file is known.
+	for (size_t i = 0; i < payloads.size(); i++)
+	{
+		uint32_t *table = (uint32_t*)payloads[i].data();
+		for (uint32_t j = 0; j <= CirqueFirmwareImage::RegionBlocks(toc[i].Length, BIN_BLOCK_SIZE); j++)
+			table[j] += toc[i].Offset;
+	}
+	header.FileSize = (uint32_t)offset;
+	header.Flags |= BIN_HAS_TOC_CHECKSUM;
+	header.TocChecksum = CirqueBootloaderCollection::Fletcher_32((const uint8_t*)toc.data(), toc.size() * sizeof(CirqueBinRegion), 0);
+
+	// Named per process and call, as several processes, or parse threads
+	// of one process, may fill the same cache entry at once.
+	static atomic<unsigned> temp_count(0);
+	struct stat st;
+	bool replace = stat(Filename.c_str(), &st) != 0 || S_ISREG(st.st_mode);
+	string temp = replace ? Filename + "." + to_string(getpid()) + "." + to_string(temp_count++) + ".tmp" : Filename;
+	ofstream file(temp, ios::binary | ios::out | ios::trunc);
+	if (!file.is_open()) return HEX_NOFILE;
+	file.write((char*)&header, sizeof(header));
+	file.write((char*)toc.data(), toc.size() * sizeof(CirqueBinRegion));
+	static const char padding[BIN_PAGE_SIZE] = { 0 };
+	uint64_t written = sizeof(header) + toc.size() * sizeof(CirqueBinRegion);
+	for (size_t i = 0; i < Image.Count(); i++)
+	{
+		file.write(padding, toc[i].Offset - written);
+		written = toc[i].Offset + (Compress ? payloads[i].size() : Image[i].Size);
+		if (Compress)
+			file.write((char*)payloads[i].data(), payloads[i].size());
+		else
+			file.write((char*)Image[i].Data, Image[i].Size);
+	}
+	file.close();
+	if (!replace) return file ? HEX_SUCCESS : HEX_NOFILE;
+	if (!file || rename(temp.c_str(), Filename.c_str()) != 0)
+	{
+		remove(temp.c_str());
+		return HEX_NOFILE;
+	}
+	return HEX_SUCCESS;
+}
+
+int CirqueHexFileParser::ReadBin()
+{
+	ifstream file(filename, ios::binary | ios::in);
+	if (!file.is_open()) return HEX_NOFILE;
+	// Check the file signature.
+	char buffer[7] = { 0 };
+	if (!file.read(buffer, 6) || string(buffer) != "Cirque") return HEX_CORRUPT;
+	// Get the binary format version.
+	uint16_t version = 0;
+	if (!file.read((char*)&version, 2)) return HEX_CORRUPT;
+
+	switch (version)
+	{
+		case 0:
+			return ReadBinV0(file);
+		case 1:
+		case BIN_COMPRESSED_VERSION:
+			file.close();
+			return ReadBinMapped(filename);
+		default:
+			printf("Binary firmware format version %d is not supported.\n", version);
+			return HEX_CORRUPT;
+	}
+}
+
+int CirqueHexFileParser::ReadBinV0( ifstream& file )
+{
+	// Read record count.
+	uint32_t count = 0;
+	file.read((char*)&count, 4);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		// Read record address and length.
+		uint32_t address = 0, length = 0;
+		file.read((char*)&address, 4);
+		file.read((char*)&length, 4);
+		if (!file) return HEX_CORRUPT;
+		// Read data straight into the image.
+		uint8_t* data = Image.AddRegion(address, length);
+		file.read((char*)data, length);
+		// Read checksum.
+		uint32_t temp = 0;
+		file.read((char*)&temp, 4);
+		if (!file || temp != Fletcher_32(data, length))
+			return HEX_CORRUPT;
+	}
+	return HEX_SUCCESS;
+}
+
+// Maps the file and points the image regions into the mapping. Only the
+// little-endian checksum is verified, which reads every region once. A
+// compressed region is checked a block at a time, so it is never held
+// decompressed as a whole.
+int CirqueHexFileParser::ReadBinMapped( const string& Path )
+{
+	const uint8_t *map;
+	size_t size;
+	int retval = MapFile( Path, map, size );
+	if( retval != HEX_SUCCESS ) return retval;
+	if( map == NULL ) return HEX_CORRUPT;
+
+	const CirqueBinHeader *header = (const CirqueBinHeader*)map;
+	bool compressed = size >= sizeof( CirqueBinHeader ) && header->Version == BIN_COMPRESSED_VERSION;
+	Image.Map( map, size, compressed ? header->PageSize : 0 );
+	if( size < sizeof( CirqueBinHeader ) || header->HeaderSize < sizeof( CirqueBinHeader ) || ( header->HeaderSize & 3 ) != 0 || header->FileSize != size ||
+		header->PageSize == 0 || ( header->PageSize & ( header->PageSize - 1 ) ) != 0 || ( compressed && header->PageSize > 65536 ) ||
+		header->HeaderSize + (uint64_t)header->RegionCount * sizeof( CirqueBinRegion ) > size ||
+		memcmp( header->Signature, "Cirque", 6 ) != 0 || ( header->Version != 1 && !compressed ) )
+	{
+		Image.Clear();
+		return HEX_CORRUPT;
+	}
+
+	const CirqueBinRegion *toc = (const CirqueBinRegion*)( map + header->HeaderSize );
+	bool has_toc_checksum = ( header->Flags & BIN_HAS_TOC_CHECKSUM ) != 0;
+	if( has_toc_checksum &&
+		CirqueBootloaderCollection::Fletcher_32( (const uint8_t*)toc, header->RegionCount * sizeof( CirqueBinRegion ), 0 ) != header->TocChecksum )
+	{
+		Image.Clear();
+		return HEX_CORRUPT;
+	}
+	for( uint32_t i = 0; i < header->RegionCount; i++ )
+	{
+		const CirqueBinRegion& region = toc[i];
+		bool valid;
+		if( compressed )
+		{
+			Image.AddMappedRegion( region.Address, region.Offset, region.Length, region.ChecksumLittle, region.ChecksumBig );
+			CirqueFletcher32 checksum( 0 );
+			valid = true;
+			for( uint32_t at = 0; at < region.Length && valid; at += header->PageSize )
+			{
+				uint32_t length = ( region.Length - at < header->PageSize ) ? region.Length - at : header->PageSize;
+				const uint8_t *data = Image.View( i, at, length );
+				valid = data != NULL;
+				if( valid ) checksum.Add( data, length );
+			}
+			valid = valid && checksum.Value() == region.ChecksumLittle;
+		}
+		else
+		{
+			valid = ( region.Offset & ( header->PageSize - 1 ) ) == 0 && (uint64_t)region.Offset + region.Length <= size &&
+				CirqueBootloaderCollection::Fletcher_32( map + region.Offset, region.Length, 0 ) == region.ChecksumLittle;
+			if( valid ) Image.AddMappedRegion( region.Address, region.Offset, region.Length, region.ChecksumLittle, region.ChecksumBig );
+		}
+		if( !valid )
+		{
+			Image.Clear();
+			return HEX_CORRUPT;
+		}
+	}
+
+	ByteOrder = header->ByteOrder;
+	return HEX_SUCCESS;
+}
+
+// Maps a little-endian ELF32 file and points a region at the file bytes of
+// each loadable segment, at its physical address. Segments are as the
+// linker left them; CoalesceRegions sorts and joins them.
+int CirqueHexFileParser::ReadElf()
+{
+	const uint8_t *map;
+	size_t size;
+	int retval = MapFile( filename, map, size );
+	if( retval != HEX_SUCCESS ) return retval;
+	if( map == NULL ) return HEX_CORRUPT;
+	Image.Map( map, size );
+
+	Elf32_Ehdr header;
+	if( size < sizeof( header ) )
+	{
+		Image.Clear();
+		return HEX_CORRUPT;
+	}
+	memcpy( &header, map, sizeof( header ) );
+	if( header.e_ident[EI_CLASS] != ELFCLASS32 || header.e_ident[EI_DATA] != ELFDATA2LSB ||
+		header.e_phentsize != sizeof( Elf32_Phdr ) || header.e_phoff + (uint64_t)header.e_phnum * sizeof( Elf32_Phdr ) > size )
+	{
+		printf( "Only little-endian ELF32 files with program headers are supported.\n" );
+		Image.Clear();
+		return HEX_CORRUPT;
+	}
+
+	for( uint32_t i = 0; i < header.e_phnum; i++ )
+	{
+		Elf32_Phdr segment;
+		memcpy( &segment, map + header.e_phoff + i * sizeof( Elf32_Phdr ), sizeof( segment ) );
+		if( segment.p_type != PT_LOAD || segment.p_filesz == 0 ) continue;
+		if( (uint64_t)segment.p_offset + segment.p_filesz > size || (uint64_t)segment.p_paddr + segment.p_filesz > 0x100000000ULL )
+		{
+			Image.Clear();
+			return HEX_CORRUPT;
+		}
+		Image.AddMappedRegion( segment.p_paddr, segment.p_offset, segment.p_filesz );
+	}
+	if( Image.Empty() )
+	{
+		Image.Clear();
+		return HEX_CORRUPT;
+	}
+	return HEX_SUCCESS;
+}
+
+uint32_t CirqueHexFileParser::Fletcher_32(const uint8_t *dataPtr, size_t bytes)
+{
+	return CirqueBootloaderCollection::Fletcher_32(dataPtr, bytes, 0);
+}
+
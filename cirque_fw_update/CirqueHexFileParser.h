@@ -1,51 +1,157 @@
-/*
-Copyright 2019 Cirque Corporation
-
-Licensed under the Apache License, Version 2.0 (the "License");
-you may not use this file except in compliance with the License.
-You may obtain a copy of the License at
-
-    http://www.apache.org/licenses/LICENSE-2.0
-
-Unless required by applicable law or agreed to in writing, software
-distributed under the License is distributed on an "AS IS" BASIS,
-WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-See the License for the specific language governing permissions and
-limitations under the License.
-*/
-
-#ifndef __CIRQUE_HEX_FILE_PARSER_H__
-#define __CIRQUE_HEX_FILE_PARSER_H__
-
-#include "CirqueHexFileRecord.h"
-#include <string>
-#include <vector>
-
-using namespace std;
-
-#define HEX_SUCCESS  ( 0  )
-#define HEX_NOFILE   (-101)
-#define HEX_CORRUPT  (-102)
-
-class CirqueHexFileParser
-{
-private:
-	string filename;
-	bool done = false;
-	bool bin = false;
-	uint32_t startSegmentAddress;
-	uint32_t startLinearAddress;
-
-public:
-	CirqueHexFileRecord* rec;
-	vector<CirqueHexFileRecord*> recList;
-
-	CirqueHexFileParser( string& Filename );
-	~CirqueHexFileParser();
-	int Parse();
-	int WriteBin(string& Filename);
-	int ReadBin();
-	uint32_t Fletcher_32(uint16_t *dataPtr, size_t bytes);
-};
-
-#endif //__CIRQUE_HEX_FILE_PARSER_H__
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_HEX_FILE_PARSER_H__
+#define __CIRQUE_HEX_FILE_PARSER_H__
+
+#include "CirqueHexFileRecord.h"
+#include "CirqueFirmwareImage.h"
+#include <string>
+#include <vector>
+#include <fstream>
+
+using namespace std;
+
+#define HEX_SUCCESS  ( 0  )
+#define HEX_NOFILE   (-101)
+#define HEX_CORRUPT  (-102)
+#define HEX_NOVERSION (-103)
+#define HEX_OVERLAP  (-104)
+#define HEX_TOO_MANY_REGIONS (-105)
+#define HEX_IN_PROGRESS ( 1 )
+
+// FormatImage takes the region count in one byte.
+#define HEX_MAX_REGIONS 255
+
+// Version WriteBin writes, and the alignment of its region payloads.
+#define BIN_VERSION 1
+#define BIN_PAGE_SIZE 4096
+// Version WriteBin writes when compressing, and its block size.
+#define BIN_COMPRESSED_VERSION 2
+#define BIN_BLOCK_SIZE 4096
+
+// Byte order of the device a binary file was made for, if known.
+#define IMAGE_BYTE_ORDER_UNKNOWN (0)
+#define IMAGE_BYTE_ORDER_LITTLE  (1)
+#define IMAGE_BYTE_ORDER_BIG     (2)
+
+// With ParseThreads at 0, Parse gives each thread at least this much of
+// the file, so small files are parsed serially.
+#define HEX_PARSE_CHUNK_MIN ( 2 * 1024 * 1024 )
+
+// The firmware version a file declares. HEX files declare it in a comment
+// in front of the records:
+//   ;CIRQUE VID=0488 PID=0001 VER=0100 REV=00001000
+// REV is optional.
+struct CirqueFirmwareVersion
+{
+	uint16_t VID = 0;
+	uint16_t PID = 0;
+	uint16_t VER = 0;
+	uint32_t REV = 0;
+	bool HasREV = false;
+};
+
+// The region count and entry point Parse will give the image of a HEX
+// file, as ScanLayout finds them without building the image.
+struct CirqueImageLayout
+{
+	size_t RegionCount = 0;
+	uint32_t EntryPoint = 0;
+};
+
+// A run of whole lines of a mapped HEX file and what parsing it found.
+// Base holds the address base at the start of the chunk; the scan for
+// address records fills in Last.
+struct CirqueHexChunk
+{
+	const uint8_t *Begin = NULL;
+	const uint8_t *End = NULL;
+	CirqueHexAddressBase Base;
+	CirqueHexAddressBase Last;
+	bool HasSegment = false;
+	bool HasExtended = false;
+	uint32_t StartSegmentAddress = 0;
+	uint32_t StartLinearAddress = 0;
+	bool HasStartSegmentAddress = false;
+	bool HasStartLinearAddress = false;
+	CirqueFirmwareImage Image;
+	bool Done = false;
+	int Result = HEX_SUCCESS;
+};
+
+class CirqueHexFileParser
+{
+private:
+	string filename;
+	bool done = false;
+	bool bin = false;
+	bool elf = false;
+	uint32_t startSegmentAddress = 0;
+	uint32_t startLinearAddress = 0;
+
+	int ParseHex();
+	int ReadBinV0( ifstream& file );
+	int ReadBinMapped( const string& Path );
+	int ReadElf();
+	static void ParseChunk( CirqueHexChunk& chunk );
+	static void ScanChunk( CirqueHexChunk& chunk );
+	int MergeChunks( vector<CirqueHexChunk>& chunks );
+
+public:
+	CirqueFirmwareImage Image;
+	// Threads Parse may use for a HEX file, 0 to choose from the file size.
+	unsigned ParseThreads = 0;
+	// Parse joins regions at most this many bytes apart, padding with 0xFF.
+	uint32_t MaxGapFill = 0;
+	// Read from and written to version 1 and 2 binary files.
+	int ByteOrder = IMAGE_BYTE_ORDER_UNKNOWN;
+	// A HEX file is loaded from this binary file if it is valid, and the
+	// parsed image written to it otherwise. See CirqueImageCache.
+	string CachePath;
+	bool FromCache = false;
+
+	CirqueHexFileParser( string& Filename );
+	~CirqueHexFileParser();
+	// Reads the file, which may be a HEX, binary or ELF32 file, then sorts
+	// and joins its regions with CoalesceRegions.
+	// A cached image is loaded only if the Fletcher-32 checksum of every
+	// region matches, which reads the whole image. Checking only the table
+	// of contents would load in time independent of the image size, but a
+	// damaged cache entry would then go to the device unnoticed.
+	int Parse();
+	int CoalesceRegions();
+	// Parse reads HEX files with ParseMapped, or with ParseParallel when
+	// more than one thread is used. ParseLines is the original line by line
+	// parser, kept for comparison.
+	int ParseMapped();
+	int ParseParallel( unsigned threads );
+	int ParseLines();
+	// Finds the layout of a HEX file and checks its records, so an update
+	// can start while the file is parsed. A file ScanLayout accepts only
+	// fails to parse if it can't be read again.
+	int ScanLayout( CirqueImageLayout& Layout );
+	// WriteBin writes the image, with the version the source file declares,
+	// as a version 1 binary file, or a compressed version 2 file. ReadBin
+	// reads both, and version 0 files.
+	int WriteBin(string& Filename, bool Compress = false);
+	int ReadBin();
+	// Reads only the version, not the records.
+	int ReadVersion( CirqueFirmwareVersion& Version );
+	uint32_t Fletcher_32(const uint8_t *dataPtr, size_t bytes);
+};
+
+#endif //__CIRQUE_HEX_FILE_PARSER_H__
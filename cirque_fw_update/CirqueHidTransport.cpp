@@ -0,0 +1,93 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueHidTransport.h"
+#include "CirqueBootloaderEmulator.h"
+#include <cstring>
+
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+CirqueHidTransport* CirqueHidTransport::Open(string& device_path)
+{
+	if (device_path.compare(0, strlen(EMULATOR_PATH_PREFIX), EMULATOR_PATH_PREFIX) == 0)
+	{
+		string options;
+		size_t colon = device_path.find(':');
+		if (colon != string::npos) options = device_path.substr(colon + 1);
+		return new CirqueBootloaderEmulator(options);
+	}
+
+	return new CirqueHidrawTransport(device_path);
+}
+
+CirqueHidrawTransport::CirqueHidrawTransport(string& device_path)
+{
+	this->fd = open(device_path.c_str(), O_RDWR);
+
+	if(this->fd == -1)
+	{
+		printf( "Could not open path: %s\n", device_path.c_str() );
+	}
+}
+
+CirqueHidrawTransport::~CirqueHidrawTransport()
+{
+	if (this->fd != -1) close(this->fd);
+}
+
+int CirqueHidrawTransport::GenFeatureIOCTL(int length, int get_not_set)
+{
+	int x = (1 + 2) << 30;
+	x += (length << 16);
+	x += (0x48) << 8;
+
+	if(get_not_set != 0)
+	{
+		x += 0x07;
+	}
+	else
+	{
+		x += 0x06;
+	}
+
+	return x;
+}
+
+int CirqueHidrawTransport::GenGETFeatureIOCTL(int length)
+{
+	return this->GenFeatureIOCTL(length, 1);
+}
+
+int CirqueHidrawTransport::GenSETFeatureIOCTL(int length)
+{
+	return this->GenFeatureIOCTL(length, 0);
+}
+
+int CirqueHidrawTransport::SetFeature(uint8_t *data, int length)
+{
+	if (this->fd == -1) return 0;
+	int ioctl_value = this->GenSETFeatureIOCTL(length);
+	return ioctl(this->fd, ioctl_value, data);
+}
+
+int CirqueHidrawTransport::GetFeature(uint8_t *data, int length)
+{
+	if (this->fd == -1) return 0;
+	int ioctl_value = this->GenGETFeatureIOCTL(length);
+	return ioctl(this->fd, ioctl_value, data);
+}
@@ -0,0 +1,61 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_HID_TRANSPORT_H__
+#define __CIRQUE_HID_TRANSPORT_H__
+
+#include <string>
+#include <cstdint>
+using namespace std;
+
+// Device paths starting with this prefix select the bootloader emulator,
+// e.g. "emu" or "emu:be,bl,state=/tmp/touchpad.emu".
+#define EMULATOR_PATH_PREFIX "emu"
+
+// Moves feature reports between CirqueBootloaderCollection and a device.
+// SetFeature/GetFeature return the number of bytes transferred or a negative
+// value on failure, like the hidraw feature report ioctls.
+class CirqueHidTransport
+{
+	public:
+	virtual ~CirqueHidTransport() {}
+	virtual bool IsOpen() = 0;
+	virtual int SetFeature(uint8_t *data, int length) = 0;
+	virtual int GetFeature(uint8_t *data, int length) = 0;
+
+	// Creates the backend that matches the device path.
+	static CirqueHidTransport* Open(string& device_path);
+};
+
+class CirqueHidrawTransport : public CirqueHidTransport
+{
+	private:
+	int fd;
+
+	int GenFeatureIOCTL(int length, int get_not_set);
+	int GenGETFeatureIOCTL(int length);
+	int GenSETFeatureIOCTL(int length);
+
+	public:
+	CirqueHidrawTransport(string& device_path);
+	~CirqueHidrawTransport();
+
+	bool IsOpen() { return (this->fd != -1); }
+	int SetFeature(uint8_t *data, int length);
+	int GetFeature(uint8_t *data, int length);
+};
+
+#endif //__CIRQUE_HID_TRANSPORT_H__
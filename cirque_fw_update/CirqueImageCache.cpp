@@ -0,0 +1,109 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "CirqueImageCache.h"
+#include "CirqueHexFileParser.h"
+
+// Entry names are 16 hex digits of the key and this suffix.
+#define ENTRY_SUFFIX ".bin"
+
+CirqueImageCache::CirqueImageCache( const string& Dir, uint64_t MaxBytes )
+{
+	dir = Dir;
+	max_bytes = MaxBytes;
+}
+
+static void HashBytes( uint64_t& hash, const void *data, size_t length )
+{
+	const uint8_t *bytes = (const uint8_t*)data;
+	for( size_t i = 0; i < length; i++ )
+		hash = ( hash ^ bytes[i] ) * 0x100000001b3ULL;
+}
+
+string CirqueImageCache::EntryPath( const string& FirmwarePath, uint32_t MaxGapFill )
+{
+	struct stat st;
+	if( stat( FirmwarePath.c_str(), &st ) != 0 ) return "";
+	if( mkdir( dir.c_str(), 0700 ) != 0 && errno != EEXIST )
+	{
+		printf( "Could not create the image cache %s.\n", dir.c_str() );
+		return "";
+	}
+
+	// FNV-1a over what identifies the file and the parse.
+	uint64_t key[7] = { (uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size,
+		(uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec, MaxGapFill, BIN_VERSION };
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	HashBytes( hash, key, sizeof( key ) );
+
+	char name[32];
+	snprintf( name, sizeof( name ), "%016llx" ENTRY_SUFFIX, (unsigned long long)hash );
+	return dir + "/" + name;
+}
+
+void CirqueImageCache::Touch( const string& EntryPath )
+{
+	utimensat( AT_FDCWD, EntryPath.c_str(), NULL, 0 );
+}
+
+void CirqueImageCache::Remove( const string& EntryPath )
+{
+	if( remove( EntryPath.c_str() ) == 0 ) printf( "Removed cached image %s.\n", EntryPath.c_str() );
+}
+
+void CirqueImageCache::Trim()
+{
+	DIR *cache_dir = opendir( dir.c_str() );
+	if( cache_dir == NULL ) return;
+
+	struct Entry
+	{
+		string Path;
+		uint64_t Size;
+		struct timespec Used;
+	};
+	vector<Entry> entries;
+	uint64_t total = 0;
+	for( struct dirent *entry = readdir( cache_dir ); entry != NULL; entry = readdir( cache_dir ) )
+	{
+		size_t length = strlen( entry->d_name );
+		if( length != 16 + strlen( ENTRY_SUFFIX ) || strcmp( entry->d_name + 16, ENTRY_SUFFIX ) != 0 ) continue;
+		struct stat st;
+		string path = dir + "/" + entry->d_name;
+		if( stat( path.c_str(), &st ) != 0 ) continue;
+		Entry e = { path, (uint64_t)st.st_size, st.st_mtim };
+		entries.push_back( e );
+		total += e.Size;
+	}
+	closedir( cache_dir );
+
+	sort( entries.begin(), entries.end(), []( const Entry& a, const Entry& b )
+		{ return a.Used.tv_sec != b.Used.tv_sec ? a.Used.tv_sec < b.Used.tv_sec : a.Used.tv_nsec < b.Used.tv_nsec; } );
+	for( size_t i = 0; i < entries.size() && total > max_bytes; i++ )
+	{
+		Remove( entries[i].Path );
+		total -= entries[i].Size;
+	}
+}
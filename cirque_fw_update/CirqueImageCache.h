@@ -0,0 +1,51 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_IMAGE_CACHE_H__
+#define __CIRQUE_IMAGE_CACHE_H__
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+// Bound of the cache unless --cache-size says otherwise.
+#define IMAGE_CACHE_DEFAULT_BYTES ( 64 * 1024 * 1024 )
+
+// Parsed firmware images kept on disk as version 1 binary files, so an
+// unchanged HEX file is only parsed once. An entry is named after the
+// device, inode, size and modification time of the file and the parse
+// options, so a file that changed misses without being read. Entries are
+// touched when they are used, and the least recently used are removed
+// when the cache outgrows its bound.
+class CirqueImageCache
+{
+	private:
+	string dir;
+	uint64_t max_bytes;
+
+	public:
+	CirqueImageCache( const string& Dir, uint64_t MaxBytes = IMAGE_CACHE_DEFAULT_BYTES );
+	// The entry for a firmware file, or an empty string if the file or the
+	// cache directory can't be used.
+	string EntryPath( const string& FirmwarePath, uint32_t MaxGapFill );
+	void Touch( const string& EntryPath );
+	void Remove( const string& EntryPath );
+	// Removes the least recently used entries until the cache fits its bound.
+	void Trim();
+};
+
+#endif //__CIRQUE_IMAGE_CACHE_H__
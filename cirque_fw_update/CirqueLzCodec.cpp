@@ -0,0 +1,140 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstring>
+#include "CirqueLzCodec.h"
+
+static inline uint32_t Read32( const uint8_t *p )
+{
+	uint32_t value;
+	memcpy( &value, p, 4 );
+	return value;
+}
+
+static inline uint8_t* WriteLength( uint8_t *op, uint32_t length )
+{
+	for( ; length >= 255; length -= 255 ) *op++ = 255;
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+uint32_t CirqueLzCodec::Compress( const uint8_t *in, uint32_t length, uint8_t *out )
+{
+	// Position + 1 of the last occurrence of each hashed 4 byte sequence.
+	uint32_t table[1 << HASH_BITS] = { 0 };
+	const uint8_t *ip = in;
+	const uint8_t *anchor = in;
+	const uint8_t *end = in + length;
+	uint8_t *op = out;
+
+	while( end - ip >= (long)MIN_MATCH )
+	{
+		uint32_t sequence = Read32( ip );
+		uint32_t hash = ( sequence * 2654435761u ) >> ( 32 - HASH_BITS );
+		uint32_t candidate = table[hash];
+		table[hash] = (uint32_t)( ip - in ) + 1;
+
+		if( candidate == 0 || ip - ( in + candidate - 1 ) > 0xFFFF || Read32( in + candidate - 1 ) != sequence )
+		{
+			ip++;
+			continue;
+		}
+
+		const uint8_t *match = in + candidate - 1;
+		uint32_t match_length = MIN_MATCH;
+		while( ip + match_length < end && match[match_length] == ip[match_length] ) match_length++;
+
+		uint32_t literals = (uint32_t)( ip - anchor );
+		uint8_t *token = op++;
+		*token = (uint8_t)( ( ( literals < 15 ) ? literals : 15 ) << 4 );
+		if( literals >= 15 ) op = WriteLength( op, literals - 15 );
+		memcpy( op, anchor, literals );
+		op += literals;
+
+		uint16_t offset = (uint16_t)( ip - match );
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+		uint32_t extra = match_length - MIN_MATCH;
+		*token |= ( extra < 15 ) ? extra : 15;
+		if( extra >= 15 ) op = WriteLength( op, extra - 15 );
+
+		ip += match_length;
+		anchor = ip;
+	}
+
+	// The rest goes out as literals.
+	uint32_t literals = (uint32_t)( end - anchor );
+	if( literals > 0 || op == out )
+	{
+		*op++ = (uint8_t)( ( ( literals < 15 ) ? literals : 15 ) << 4 );
+		if( literals >= 15 ) op = WriteLength( op, literals - 15 );
+		if( literals > 0 ) memcpy( op, anchor, literals );
+		op += literals;
+	}
+	return (uint32_t)( op - out );
+}
+
+bool CirqueLzCodec::Decompress( const uint8_t *in, uint32_t in_length, uint8_t *out, uint32_t length )
+{
+	const uint8_t *ip = in;
+	const uint8_t *in_end = in + in_length;
+	uint8_t *op = out;
+	uint8_t *out_end = out + length;
+
+	while( ip < in_end )
+	{
+		uint8_t token = *ip++;
+
+		uint32_t literals = token >> 4;
+		if( literals == 15 )
+		{
+			uint8_t more;
+			do
+			{
+				if( ip >= in_end ) return false;
+				more = *ip++;
+				literals += more;
+			} while( more == 255 );
+		}
+		if( literals > (uint32_t)( in_end - ip ) || literals > (uint32_t)( out_end - op ) ) return false;
+		memcpy( op, ip, literals );
+		ip += literals;
+		op += literals;
+		if( ip == in_end ) break;
+
+		if( in_end - ip < 2 ) return false;
+		uint32_t offset = ip[0] | ( ip[1] << 8 );
+		ip += 2;
+		uint32_t match_length = ( token & 0x0F ) + MIN_MATCH;
+		if( ( token & 0x0F ) == 15 )
+		{
+			uint8_t more;
+			do
+			{
+				if( ip >= in_end ) return false;
+				more = *ip++;
+				match_length += more;
+			} while( more == 255 );
+		}
+		if( offset == 0 || offset > (uint32_t)( op - out ) || match_length > (uint32_t)( out_end - op ) ) return false;
+
+		// Byte by byte, since a match may overlap the bytes it produces.
+		const uint8_t *match = op - offset;
+		for( uint32_t i = 0; i < match_length; i++ ) op[i] = match[i];
+		op += match_length;
+	}
+	return op == out_end;
+}
@@ -0,0 +1,47 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_LZ_CODEC_H__
+#define __CIRQUE_LZ_CODEC_H__
+
+#include <cstdint>
+
+// A small LZ77 block codec in the style of LZ4, for firmware images. A
+// block is a series of sequences:
+//   token    high nibble literal count, low nibble match length - 4
+//   [255...] more literal count when the nibble is 15
+//   literals
+//   offset   2 bytes, little-endian, back from the current position
+//   [255...] more match length when the nibble is 15
+// The last sequence ends after its literals. Blocks are independent and
+// at most 64 KB.
+class CirqueLzCodec
+{
+	private:
+	static const int HASH_BITS = 12;
+	static const uint32_t MIN_MATCH = 4;
+
+	public:
+	// Room the compressed form of length bytes may need.
+	static uint32_t Bound( uint32_t length ) { return length + length / 255 + 16; }
+	// Compresses length bytes into out, which holds Bound( length ) bytes,
+	// and returns the compressed size.
+	static uint32_t Compress( const uint8_t *in, uint32_t length, uint8_t *out );
+	// Returns false unless in decompresses to exactly length bytes.
+	static bool Decompress( const uint8_t *in, uint32_t in_length, uint8_t *out, uint32_t length );
+};
+
+#endif //__CIRQUE_LZ_CODEC_H__
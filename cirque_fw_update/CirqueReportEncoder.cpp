@@ -0,0 +1,175 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueReportEncoder.h"
+#include <cstring>
+
+CirqueReportEncoder::CirqueReportEncoder(uint8_t id)
+{
+	this->report_id = id;
+}
+
+void CirqueReportEncoder::Begin(uint8_t command)
+{
+	this->length = 0;
+	this->PutU8(this->report_id);
+	this->PutU8(command);
+}
+
+void CirqueReportEncoder::PutU16(uint16_t value)
+{
+	this->frame[this->length++] = (value >> 0) & 0xFF;
+	this->frame[this->length++] = (value >> 8) & 0xFF;
+}
+
+void CirqueReportEncoder::PutU32(uint32_t value)
+{
+	this->frame[this->length++] = (value >> 0) & 0xFF;
+	this->frame[this->length++] = (value >> 8) & 0xFF;
+	this->frame[this->length++] = (value >> 16) & 0xFF;
+	this->frame[this->length++] = (value >> 24) & 0xFF;
+}
+
+void CirqueReportEncoder::PutBytes(const uint8_t *data, uint32_t count)
+{
+	memcpy(&this->frame[this->length], data, count);
+	this->length += count;
+}
+
+int CirqueReportEncoder::Pad()
+{
+	// Only the bytes used since the last padding can be non-zero.
+	if (this->used > this->length)
+	{
+		memset(&this->frame[this->length], 0, this->used - this->length);
+	}
+	this->used = this->length;
+	return REPORT_LENGTH;
+}
+
+uint16_t CirqueReportEncoder::Fletcher_16(const uint8_t *dataPtr, size_t bytes)
+{
+	uint16_t sum1 = 0xff;
+	uint16_t sum2 = 0xff;
+
+	while (bytes)
+	{
+		uint32_t tlen = bytes > 20 ? 20 : bytes;
+		bytes -= tlen;
+		do
+		{
+			sum2 += sum1 += *dataPtr++;
+		} while (--tlen);
+		sum1 = (sum1 & 0xff) + (sum1 >> 8);
+		sum2 = (sum2 & 0xff) + (sum2 >> 8);
+	}
+
+	// Second reduction step to reduce sums to 8 bits
+	sum1 = (sum1 & 0xff) + (sum1 >> 8);
+	sum2 = (sum2 & 0xff) + (sum2 >> 8);
+	return sum2 << 8 | sum1;
+}
+
+int CirqueReportEncoder::Write(uint32_t offset, const uint8_t *data, uint32_t count)
+{
+	if (count > REPORT_LENGTH - WRITE_HEADER_LENGTH) return -1;
+
+	this->Begin(BL_CMD_WRITE);
+	this->PutU32(offset);
+	this->PutU32(count);
+	this->PutBytes(data, count);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::Flush()
+{
+	this->Begin(BL_CMD_FLUSH);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::Validate(uint8_t validation)
+{
+	this->Begin(BL_CMD_VALIDATE);
+	this->PutU8(validation);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::Reset()
+{
+	this->Begin(BL_CMD_RESET);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::FormatImage(uint8_t layout, uint8_t num_regions, uint32_t entry_point, uint16_t hid_descriptor_addr, uint8_t i2c_addr)
+{
+	this->Begin(BL_CMD_FORMAT_IMAGE);
+	this->PutU8(layout);
+	this->PutU8(num_regions);
+	this->PutU32(entry_point);
+	this->PutU16(hid_descriptor_addr);
+	this->PutU8(i2c_addr);
+	this->PutU8(this->report_id);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::FormatRegion(uint8_t region, uint32_t offset, uint32_t size, uint32_t checksum)
+{
+	this->Begin(BL_CMD_FORMAT_REGION);
+	this->PutU8(region);
+	this->PutU32(offset);
+	this->PutU32(size);
+	this->PutU32(checksum);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::Invoke()
+{
+	this->Begin(BL_CMD_INVOKE_BL);
+	return this->Pad();
+}
+
+int CirqueReportEncoder::WriteMem(uint32_t addr, const uint8_t *data, uint16_t count)
+{
+	if (count > REPORT_LENGTH - WRITE_MEM_OVERHEAD) return -1;
+
+	this->Begin(BL_CMD_WRITE_MEM);
+	this->PutU32(addr);
+	this->PutU16(count);
+	this->PutBytes(data, count);
+
+	// The checksum covers everything after the report ID.
+	this->PutU16(Fletcher_16(&this->frame[1], 1 + 4 + 2 + count));
+	return this->Pad();
+}
+
+int CirqueReportEncoder::ReadMem(uint32_t addr, uint16_t count)
+{
+	// The read request is sent without padding.
+	this->Begin(BL_CMD_READ_MEM);
+	this->PutU32(addr);
+	this->PutU16(count);
+	if (this->used < this->length) this->used = this->length;
+	return this->length;
+}
+
+int CirqueReportEncoder::Status()
+{
+	// The device fills the whole frame.
+	this->length = 0;
+	this->PutU8(this->report_id);
+	this->used = REPORT_LENGTH;
+	return REPORT_LENGTH;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_REPORT_ENCODER_H__
+#define __CIRQUE_REPORT_ENCODER_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// Builds bootloader feature reports in a single frame that is reused for
+// every command. Each command writer lays out its fields, zeroes whatever
+// the previous report left behind and returns the number of bytes to send.
+class CirqueReportEncoder
+{
+	public:
+	static const int REPORT_LENGTH = 531;
+	// Report ID, command, offset and byte count in front of WRITE data.
+	static const int WRITE_HEADER_LENGTH = 10;
+	// Report ID, command, address, length and checksum around WRITE_MEM data.
+	static const int WRITE_MEM_OVERHEAD = 10;
+
+	private:
+	static const uint8_t BL_CMD_WRITE = 0;
+	static const uint8_t BL_CMD_FLUSH = 1;
+	static const uint8_t BL_CMD_VALIDATE = 2;
+	static const uint8_t BL_CMD_RESET = 3;
+	static const uint8_t BL_CMD_FORMAT_IMAGE = 4;
+	static const uint8_t BL_CMD_FORMAT_REGION = 5;
+	static const uint8_t BL_CMD_INVOKE_BL = 6;
+	static const uint8_t BL_CMD_WRITE_MEM = 7;
+	static const uint8_t BL_CMD_READ_MEM = 8;
+
+	uint8_t frame[REPORT_LENGTH];
+	uint8_t report_id;
+	int length = 0;
+	int used = REPORT_LENGTH;
+
+	void Begin(uint8_t command);
+	void PutU8(uint8_t value) { this->frame[this->length++] = value; }
+	void PutU16(uint16_t value);
+	void PutU32(uint32_t value);
+	void PutBytes(const uint8_t *data, uint32_t count);
+	int Pad();
+
+	public:
+	CirqueReportEncoder(uint8_t id);
+
+	uint8_t* Frame() { return this->frame; }
+	static uint16_t Fletcher_16(const uint8_t *dataPtr, size_t bytes);
+
+	int Write(uint32_t offset, const uint8_t *data, uint32_t count);
+	int Flush();
+	int Validate(uint8_t validation);
+	int Reset();
+	int FormatImage(uint8_t layout, uint8_t num_regions, uint32_t entry_point, uint16_t hid_descriptor_addr, uint8_t i2c_addr);
+	int FormatRegion(uint8_t region, uint32_t offset, uint32_t size, uint32_t checksum);
+	int Invoke();
+	int WriteMem(uint32_t addr, const uint8_t *data, uint16_t count);
+	int ReadMem(uint32_t addr, uint16_t count);
+
+	// Prepares the frame to receive a status report.
+	int Status();
+};
+
+#endif //__CIRQUE_REPORT_ENCODER_H__
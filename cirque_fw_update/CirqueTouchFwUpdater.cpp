@@ -1,509 +1,877 @@
-/*
-Copyright 2019 Cirque Corporation
-
-Licensed under the Apache License, Version 2.0 (the "License");
-you may not use this file except in compliance with the License.
-You may obtain a copy of the License at
-
-    http://www.apache.org/licenses/LICENSE-2.0
-
-Unless required by applicable law or agreed to in writing, software
-distributed under the License is distributed on an "AS IS" BASIS,
-WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-See the License for the specific language governing permissions and
-limitations under the License.
-*/
-
-#include <string>
-#include <cstring>
-#include <iostream>
-#include <stdexcept>
-#include <unistd.h>
-#include <sys/stat.h>
-#include "dirent.h"
-#include "CirqueBootloaderCollection.h"
-#include "CirqueDevData.h"
-#include "CirqueHexFileParser.h"
-
-#define VERSION "2.1.1"
-#define DATE "2025-04-10"
-#define COPYRIGHT "Copyright (c) 2025 Cirque Corporation\nAll rights reserved."
-
-using namespace std;
-
-vector<string> find_cirque_devices(void)
-{
-	DIR * hidraw_dir = opendir("/sys/class/hidraw");
-	vector<string> devices;
-
-	if(hidraw_dir != NULL)
-	{
-		struct dirent * entry = readdir(hidraw_dir);
-		
-		while (entry != NULL)
-		{
-			if(strncmp("hidraw",entry->d_name, 6) == 0)
-			{
-				// Find the device that is pointed to by the "device" symlink
-				string device_link = string("/sys/class/hidraw/");
-				device_link += entry->d_name;
-				device_link += "/device";
-
-				char link_buffer[512] = {0};
-				
-				ssize_t count = readlink(device_link.c_str(), link_buffer, sizeof(link_buffer));
-				string link = string(link_buffer);
-				size_t last_slash = link.find_last_of("/");
-				string device_id_name = link.substr(last_slash + 1);
-
-				// device_id_name is of the form BusID:VID:PID.#
-				// split them up into a vector
-				while(device_id_name.find_first_of(".") != string::npos)
-				{
-					device_id_name.replace(device_id_name.find_first_of("."), 1, ":");
-				}
-				
-				vector<string> device_id_elements;
-				size_t start_position = 0;
-				while(start_position != string::npos)
-				{
-					size_t search_start = (start_position == 0) ? 0 : start_position + 1;
-					size_t delimiter_pos = device_id_name.find(":", search_start);
-					size_t length = (delimiter_pos == string::npos) ? string::npos : delimiter_pos - search_start;
-					
-					device_id_elements.push_back( device_id_name.substr(search_start, length) );
-					start_position = delimiter_pos;
-				}
-
-				// Check if the VID matches Cirque's VID
-				if(device_id_elements[1].compare("0488") == 0)
-				{
-					string dev_path = "/dev/";
-					dev_path += entry->d_name;
-					devices.push_back(dev_path);
-				}
-			}
-			
-			entry = readdir(hidraw_dir);
-		}
-
-		closedir(hidraw_dir);
-	}
-
-	return devices;
-}
-
-void dump_raw_data(string hid_device_path)
-{
-	CirqueBootloaderCollection bl(hid_device_path);
-	if( !bl.SanityCheck() ) return;
-
-	CirqueDevData dev_data(&bl);
-
-	uint32_t rev = 0;
-	int is_dirty = 1;
-	int is_branch = 1;
-	dev_data.GetVersionInfo(rev, is_dirty, is_branch);
-	printf("  rev: %d, %s %s\n",
-		rev,
-		(is_dirty)?"Dirty":"Pristine",
-		(is_branch)?"Branch":"Trunk");
-
-	// Disable normal feeds while gathering data
-	uint8_t feed_cfg2 = bl.ExtendedRead(0x200E0009,1)[0];
-	uint8_t feed_control = bl.ExtendedRead(0x200E000A,1)[0];
-	vector<uint8_t> write_data = {(uint8_t)(feed_control & 0xF8)};
-	bl.ExtendedWrite(0x200E000A, write_data);
-
-	// Sleep to allow touch buffer to empty out
-	usleep(50*1000);
-
-	vector<vector<int16_t>> image = dev_data.GetCompensationImage();
-	cout << dev_data.PrintImageArray(string("Current Compensation Matrix"),
-		image);
-
-	image = dev_data.GetRawMeasurementImage();
-	cout << dev_data.PrintImageArray(string("Live Raw Measurements"),
-		image);
-
-	image = dev_data.GetUncompensatedImage();
-	cout << dev_data.PrintImageArray(string("Live Uncompensated Image"),
-		image);
-
-	image = dev_data.GetCompensatedImage();
-	cout << dev_data.PrintImageArray(string("Live Compensated Image"),
-		image);
-
-	// Restore feed control settings
-	write_data[0] = (uint8_t) ((feed_control & 0xF8) | (1 << (feed_cfg2 & 0x03)));
-	bl.ExtendedWrite(0x200E000A, write_data);
-}
-
-int IsBootloader(uint16_t sentinel)
-{
-	switch (sentinel)
-	{
-	case 0xC35A:
-	case 0x6C42: //'lB'
-		return 1;
-	case 0x5AC3:
-	case 0x6D49: //'mI'
-	case 0x426C: //'Bl' for old firmware
-		return 0;
-	default:
-		return -1;
-	}
-	return -1;
-}
-
-uint16_t get_device_attributes(string& hid_device_path)
-{
-	int retval = BL_FAILURE;
-	CirqueBootloaderCollection bl(hid_device_path);
-
-	uint16_t vid = 0, pid = 0, ver = 0;
-	uint32_t rev = 0;
-	if( bl.GetVersionInfo(vid, pid, ver, rev) == BL_SUCCESS )
-	{
-		printf("  %s: VID %04X  PID %04X  VER %04X  REV %08X\n", hid_device_path.c_str(), vid, pid, ver, rev );
-	}
-	else
-	{
-		printf("%s: Failed to get device firmware version.\n", hid_device_path.c_str());
-	}
-	return ver;
-}
-
-int get_fw_version(string& hid_device_path, uint16_t& ver)
-{
-	uint16_t vid = 0, pid = 0;
-	uint32_t rev = 0;
-	CirqueBootloaderCollection bl(hid_device_path);
-	CirqueBootloaderStatus status;
-
-	if (!bl.IsConnected()) return BL_FAILURE;
-	
-	int ret = bl.GetStatus(status);
-	if (ret != BL_SUCCESS) return ret;
-
-	// Return version 00.00 if the device is in bootloader mode.
-	if (IsBootloader(status.Sentinel) == 1)
-	{
-		ver = 0;
-	}
-	else
-	{
-		bl.GetVersionInfo(vid, pid, ver, rev);
-	}
-
-	return BL_SUCCESS;
-}
-
-int update_firmware(string& hid_device_path, string& hex_file_path)
-{
-	CirqueBootloaderCollection bl(hid_device_path);
-	if (!bl.IsConnected()) return BL_FAILURE;
-
-	// Sanity check to get the endianness.
-	int retry = 0;
-	if (!bl.SanityCheck())
-	{
-		// We couldn't get endianness. We may be in bootloader mode.
-		// Assume the firmware is little-endian and try it.
-		// If it fails, we'll try big-endian.
-		bl.IS_BIG_ENDIAN = 0;
-		retry = 1;
-		printf("Sanity check failed.\n");
-	}
-
-	// Load and parse the hex file.
-	CirqueHexFileParser hfp(hex_file_path);
-	int retval = hfp.Parse();
-	switch( retval )
-	{
-		case HEX_NOFILE:
-			printf("Firmware file %s does not exist.\n", hex_file_path.c_str());
-			return retval;
-		case HEX_CORRUPT:
-			printf("Firmware file %s is corrupted.\n", hex_file_path.c_str());
-			return retval;
-		default:
-			break;
-	}
-	printf("Finished parsing %s: %d records.\n", hex_file_path.c_str(), (int)hfp.recList.size());
-
-	FirmwareUpdateSequence:
-	// Get timing values.
-	uint32_t FormatImageDelay = 100;
-	uint32_t FormatRegionsPageDelay = 50;
-	uint32_t PageWriteDelay = 10;
-
-	CirqueBootloaderStatus status;
-	retval = bl.GetStatus( status );
-	printf("GetStatus returned %d.\n", retval);
-	if( retval != BL_SUCCESS ) return retval;
-
-	printf( "Status: Sentinel 0x%04X Version 0x%02X Error %d\n", status.Sentinel, status.Version, status.LastError );
-
-	if( status.LastError != NV_err_none )
-	{
-		// Clear the error and retry.
-		retval = bl.Reset();
-		printf("Reset returned %d.\n", retval);
-		if( retval != BL_SUCCESS ) return retval;
-		usleep(100000);
-
-		// Check status.
-		if (bl.GetStatus( status ) != BL_SUCCESS || status.LastError != NV_err_none)
-		{
-			printf("GetStatus after reset failed with error %d.\n", status.LastError);
-			return BL_FAILURE;
-		}
-	}
-
-	// Invoke bootloader.
-	if( status.Sentinel == 0x5AC3 || status.Sentinel == 0x6D49 || status.Sentinel == 0x426C )
-	{
-		retval = bl.Invoke();
-		printf("Invoke bootloader returned %d.\n", retval);
-		if( retval != BL_SUCCESS ) return retval;
-		usleep(100000);
-
-		retval = bl.GetStatus( status );
-		printf("GetStatus returned %d.\n", retval);
-		if( retval != BL_SUCCESS ) return retval;
-
-		printf( "Status: Sentinel 0x%04X Version 0x%02X Error %d\n", status.Sentinel, status.Version, status.LastError );
-
-	}
-	if( status.Version >= 0x08)
-	{
-		FormatRegionsPageDelay = status.RegionFormatDelayMsPer1K;
-		PageWriteDelay = status.ByteWriteDelayUs;
-	}
-	printf("Timing values: FormatImageDelay %d, FormatRegionsPageDelay %d, PageWriteDelay %d.\n", FormatImageDelay, FormatRegionsPageDelay, PageWriteDelay);
-
-	// Format image.
-	uint32_t EntryPoint = hfp.recList[0]->buf[4] |
-						( hfp.recList[0]->buf[5] << 8 ) |
-						( hfp.recList[0]->buf[6] << 16 ) |
-						( hfp.recList[0]->buf[7] << 24 );
-
-	uint8_t TargetI2CAddress = 0x2C;
-	uint16_t TargetHIDDescAddr = 0x0020;
-	if( status.Version >= 0x09)
-	{
-		TargetI2CAddress = 0xFF;
-		TargetHIDDescAddr = 0xFFFF;
-	}
-
-	printf("FormatImage called with size %d, entry point 0x%08X, I2C address 0x%02X, HID descriptor address 0x%04X.\n", (uint8_t)hfp.recList.size(), EntryPoint, TargetI2CAddress, TargetHIDDescAddr );
-	retval = bl.FormatImage( (uint8_t)hfp.recList.size(), EntryPoint, TargetI2CAddress, TargetHIDDescAddr );
-	printf("FormatImage returned %d.\n", retval);
-	if( retval != BL_SUCCESS ) return retval;
-
-	usleep(FormatImageDelay * 1000);
-
-	// Format regions.
-	for( int temp = 0; temp < hfp.recList.size(); temp++ )
-	{
-		retval = bl.FormatRegion( (uint8_t)temp, hfp.recList[temp]->getAddress(), hfp.recList[temp]->buf );
-		printf("FormatRegion returned %d.\n", retval);
-		if( retval != BL_SUCCESS ) return retval;
-
-		usleep((FormatRegionsPageDelay * 1000 * ((hfp.recList[temp]->buf.size() / 1024) + 1)));
-
-		if (bl.GetStatus( status ) != BL_SUCCESS || status.LastError != NV_err_none)
-		{
-			printf("GetStatus failed with error %d.\n", status.LastError);
-			return BL_FAILURE;
-		}
-		printf("GetStatus returned %d.\n", BL_SUCCESS);
-	}
-
-	// Write data.
-	uint32_t Length, MaxDataPayloadSize = 520; // must be even, better if multiple of 4 (520 / 4 = 130)
-
-	for (int i = 0; i < hfp.recList.size(); i++)
-	{
-		Length = (uint32_t)hfp.recList[i]->buf.size();
-		printf("Writing %d bytes of data.\n", Length);
-
-		while (Length > 0)
-		{
-			uint32_t PayloadSize = ( Length > MaxDataPayloadSize ) ? MaxDataPayloadSize : Length;
-
-			vector<uint8_t> Payload;
-			Payload.clear();
-			Payload.insert( Payload.end(), hfp.recList[i]->buf.begin() + hfp.recList[i]->buf.size() - Length, hfp.recList[i]->buf.begin() + hfp.recList[i]->buf.size() - Length + PayloadSize );
-
-			retval = bl.WriteData( (uint32_t)hfp.recList[i]->getAddress() + (hfp.recList[i]->buf.size() - Length), PayloadSize, Payload );
-			if( retval != BL_SUCCESS ) return retval;
-
-			usleep( ( PageWriteDelay * PayloadSize > 1000 ) ? PageWriteDelay * PayloadSize : 1000 );
-
-			if (bl.GetStatus( status ) != BL_SUCCESS || status.LastError != NV_err_none)
-			{
-				printf("GetStatus while writing data failed with error %d.\n", status.LastError);
-				return BL_FAILURE;
-			}
-			// printf("WriteData length %d.\n", Length);
-
-			Length = ( Length > MaxDataPayloadSize ) ? Length - MaxDataPayloadSize : 0;
-		}
-	}
-
-	// Flush.
-	bl.Flush();
-	usleep(10000);
-	if (bl.GetStatus( status ) != BL_SUCCESS || status.LastError != NV_err_none)
-	{
-		printf("GetStatus after flushing failed with error %d.\n", status.LastError);
-		return BL_FAILURE;
-	}
-	printf("Flush successful.\n");
-
-	// Validate.
-	bl.Validate(EntireImage);
-	usleep(10000);
-	if (bl.GetStatus( status ) != BL_SUCCESS || status.LastError != NV_err_none)
-	{
-		printf("GetStatus after image validation failed with error %d.\n", status.LastError);
-		// If we failed with checksum mismatch, it's possible we used the wrong endianness.
-		// Let's change the endianness and retry.
-		if (retry && status.LastError == NV_err_chksum_mismatch)
-		{
-			printf("Restarting the update sequence.\n");
-			retry = 0;
-			bl.IS_BIG_ENDIAN = !bl.IS_BIG_ENDIAN;
-			goto FirmwareUpdateSequence;
-		}
-		return BL_FAILURE;
-	}
-	printf("Validation successful.\n");
-
-	// Reset.
-	retval = bl.Reset();
-	printf("Reset returned %d.\n", retval);
-	if( retval != BL_SUCCESS ) return retval;
-	usleep(100000);
-
-	// Check status.
-	if (bl.GetStatus( status ) != BL_SUCCESS || status.LastError != NV_err_none)
-	{
-		printf("GetStatus after reset failed with error %d.\n", status.LastError);
-		return BL_FAILURE;
-	}
-	printf("Firmware update successful.\n");
-
-	return 0;
-}
-
-int main (int argc, char * argv[])
-{
-	string device, fw_file;
-	int ret = 0;
-
-	if( argc > 1 && strcmp( argv[1], "-r" ) == 0 )
-	{
-		vector<string> devices;
-
-		if (argc < 3)
-		{
-			devices = find_cirque_devices();
-		}
-		else
-		{
-			devices.push_back(string(argv[2]));
-		}
-		
-		for(int i = 0; i < devices.size(); ++i)
-		{
-			printf("Querying device %s\n", devices[i].c_str());
-			dump_raw_data(devices[i]);
-		}
-
-		return 0;
-	}
-
-	if (argc > 1 && strcmp(argv[1], "-l") == 0)
-	{
-		vector<string> devices;
-
-		if (argc < 3)
-		{
-			devices = find_cirque_devices();
-		}
-		else
-		{
-			devices.push_back(string(argv[2]));
-		}
-
-		printf("Available devices:\n");
-		for (int i = 0; i < devices.size(); ++i)
-		{
-			get_device_attributes(devices[i]);
-		}
-
-		return 0;
-	}
-
-	if (argc > 1 && strcmp(argv[1], "-v") == 0)
-	{
-		printf("Cirque touchpad firmware updater %s (%s)\n%s\n", VERSION, DATE, COPYRIGHT);
-
-		return 0;
-	}
-
-	switch( argc )
-	{
-		case 3:
-			struct stat mode;
-			mode.st_mode = 020660;
-			stat( argv[2], &mode );
-			chmod( argv[2], mode.st_mode | S_IROTH | S_IWOTH );
-			device = argv[2];
-			if( strcmp( argv[1], "-a" ) == 0 )
-			{
-				// Get and output the version number.
-				// Suppress all standard output temporarily.
-				int fd = dup(1);
-				close(1);
-				uint16_t ver = 0;
-				ret = get_fw_version(device, ver);
-				// Resume standard output.
-				fflush(stdout);
-				dup2(fd, 1);
-				close(fd);
-				if(ret == 0) printf("%02X.%02X\n", ver >> 8, ver & 0xFF);
-				return ret;
-			}
-			else if( strcmp( argv[1], "-n" ) == 0 )
-			{
-				// Get the version number.
-				printf("Querying device %s\n", device.c_str());
-				ret = get_device_attributes(device);
-			}
-			else
-			{
-				// Update firmware.
-				fw_file = argv[1];
-				printf("Updating device %s with firmware from %s\n", device.c_str(), fw_file.c_str());
-				ret = update_firmware(device, fw_file);
-				if(ret != BL_SUCCESS)
-					printf("Firmware update failed.\n");
-			}
-			chmod( argv[2], mode.st_mode );
-			return ret;
-		default:
-			printf("To update firmware, enter:\n");
-			printf("  sudo %s <firmware_filepath> <device_filepath>\n", argv[0]);
-			printf("To find the device path, list all available devices by running:\n");
-			printf("  sudo %s -l\n", argv[0]);
-			printf("To get the version of this firmware update tool, enter:\n");
-			printf("  sudo %s -v\n", argv[0]);
-			return -1;
-	}
-	
-	return 0;
-}
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <string>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dirent.h"
+#include "CirqueBootloaderCollection.h"
+#include "CirqueDevData.h"
+#include "CirqueHexFileParser.h"
+#include "CirqueHexDecoder.h"
+#include "CirqueTiming.h"
+#include "CirqueUpdateSession.h"
+#include "CirqueEventLoop.h"
+
+#define VERSION "2.1.1"
+#define DATE "2025-04-10"
+#define COPYRIGHT "Copyright (c) 2025 Cirque Corporation\nAll rights reserved."
+
+using namespace std;
+
+// Trace track of the work that isn't tied to one device, like parsing.
+#define TRACE_HOST_TRACK 1
+
+vector<string> find_cirque_devices(void)
+{
+	DIR * hidraw_dir = opendir("/sys/class/hidraw");
+	vector<string> devices;
+
+	if(hidraw_dir != NULL)
+	{
+		struct dirent * entry = readdir(hidraw_dir);
+		
+		while (entry != NULL)
+		{
+			if(strncmp("hidraw",entry->d_name, 6) == 0)
+			{
+				// Find the device that is pointed to by the "device" symlink
+				string device_link = string("/sys/class/hidraw/");
+				device_link += entry->d_name;
+				device_link += "/device";
+
+				char link_buffer[512] = {0};
+				
+				ssize_t count = readlink(device_link.c_str(), link_buffer, sizeof(link_buffer));
+				string link = string(link_buffer);
+				size_t last_slash = link.find_last_of("/");
+				string device_id_name = link.substr(last_slash + 1);
+
+				// device_id_name is of the form BusID:VID:PID.#
+				// split them up into a vector
+				while(device_id_name.find_first_of(".") != string::npos)
+				{
+					device_id_name.replace(device_id_name.find_first_of("."), 1, ":");
+				}
+				
+				vector<string> device_id_elements;
+				size_t start_position = 0;
+				while(start_position != string::npos)
+				{
+					size_t search_start = (start_position == 0) ? 0 : start_position + 1;
+					size_t delimiter_pos = device_id_name.find(":", search_start);
+					size_t length = (delimiter_pos == string::npos) ? string::npos : delimiter_pos - search_start;
+					
+					device_id_elements.push_back( device_id_name.substr(search_start, length) );
+					start_position = delimiter_pos;
+				}
+
+				// Check if the VID matches Cirque's VID
+				if(device_id_elements[1].compare("0488") == 0)
+				{
+					string dev_path = "/dev/";
+					dev_path += entry->d_name;
+					devices.push_back(dev_path);
+				}
+			}
+			
+			entry = readdir(hidraw_dir);
+		}
+
+		closedir(hidraw_dir);
+	}
+
+	return devices;
+}
+
+void dump_raw_data(string hid_device_path, CirqueTraceLog* trace)
+{
+	CirqueBootloaderCollection bl(hid_device_path);
+	if( trace )
+	{
+		bl.Trace = trace;
+		bl.TraceTrack = trace->AddTrack(hid_device_path);
+	}
+	if( !bl.SanityCheck() ) return;
+
+	CirqueDevData dev_data(&bl);
+
+	uint32_t rev = 0;
+	int is_dirty = 1;
+	int is_branch = 1;
+	dev_data.GetVersionInfo(rev, is_dirty, is_branch);
+	printf("  rev: %d, %s %s\n",
+		rev,
+		(is_dirty)?"Dirty":"Pristine",
+		(is_branch)?"Branch":"Trunk");
+
+	// Disable normal feeds while gathering data
+	uint8_t feed_cfg2 = bl.ExtendedRead(0x200E0009,1)[0];
+	uint8_t feed_control = bl.ExtendedRead(0x200E000A,1)[0];
+	vector<uint8_t> write_data = {(uint8_t)(feed_control & 0xF8)};
+	bl.ExtendedWrite(0x200E000A, write_data);
+
+	// Sleep to allow touch buffer to empty out
+	usleep(50*1000);
+
+	vector<vector<int16_t>> image = dev_data.GetCompensationImage();
+	cout << dev_data.PrintImageArray(string("Current Compensation Matrix"),
+		image);
+
+	image = dev_data.GetRawMeasurementImage();
+	cout << dev_data.PrintImageArray(string("Live Raw Measurements"),
+		image);
+
+	image = dev_data.GetUncompensatedImage();
+	cout << dev_data.PrintImageArray(string("Live Uncompensated Image"),
+		image);
+
+	image = dev_data.GetCompensatedImage();
+	cout << dev_data.PrintImageArray(string("Live Compensated Image"),
+		image);
+
+	// Restore feed control settings
+	write_data[0] = (uint8_t) ((feed_control & 0xF8) | (1 << (feed_cfg2 & 0x03)));
+	bl.ExtendedWrite(0x200E000A, write_data);
+}
+
+uint16_t get_device_attributes(string& hid_device_path)
+{
+	int retval = BL_FAILURE;
+	CirqueBootloaderCollection bl(hid_device_path);
+
+	uint16_t vid = 0, pid = 0, ver = 0;
+	uint32_t rev = 0;
+	if( bl.GetVersionInfo(vid, pid, ver, rev) == BL_SUCCESS )
+	{
+		printf("  %s: VID %04X  PID %04X  VER %04X  REV %08X\n", hid_device_path.c_str(), vid, pid, ver, rev );
+	}
+	else
+	{
+		printf("%s: Failed to get device firmware version.\n", hid_device_path.c_str());
+	}
+	return ver;
+}
+
+int get_fw_version(string& hid_device_path, uint16_t& ver)
+{
+	uint16_t vid = 0, pid = 0;
+	uint32_t rev = 0;
+	CirqueBootloaderCollection bl(hid_device_path);
+	CirqueBootloaderStatus status;
+
+	if (!bl.IsConnected()) return BL_FAILURE;
+	
+	int ret = bl.GetStatus(status);
+	if (ret != BL_SUCCESS) return ret;
+
+	// Return version 00.00 if the device is in bootloader mode.
+	if (IsBootloader(status.Sentinel) == 1)
+	{
+		ver = 0;
+	}
+	else
+	{
+		bl.GetVersionInfo(vid, pid, ver, rev);
+	}
+
+	return BL_SUCCESS;
+}
+
+int parse_firmware(CirqueHexFileParser& hfp, string& hex_file_path, UpdateOptions& options, int track = TRACE_HOST_TRACK)
+{
+	// Load and parse the hex file.
+	CirqueTraceLog* trace = options.Trace;
+	hfp.ParseThreads = options.ParseThreads;
+	hfp.MaxGapFill = options.MaxGapFill;
+	CirqueImageCache cache(options.CacheDir, options.CacheBytes);
+	if (!options.CacheDir.empty()) hfp.CachePath = cache.EntryPath(hex_file_path, options.MaxGapFill);
+	int span = trace ? trace->Begin(track, "Parse " + hex_file_path) : -1;
+	int retval = hfp.Parse();
+	if( trace ) trace->End(span);
+	if (hfp.FromCache)
+		cache.Touch(hfp.CachePath);
+	else if (!hfp.CachePath.empty())
+		cache.Trim();
+	switch( retval )
+	{
+		case HEX_NOFILE:
+			printf("Firmware file %s does not exist.\n", hex_file_path.c_str());
+			return retval;
+		case HEX_CORRUPT:
+			printf("Firmware file %s is corrupted.\n", hex_file_path.c_str());
+			return retval;
+		case HEX_OVERLAP:
+		case HEX_TOO_MANY_REGIONS:
+			printf("Firmware file %s can't be written to the device.\n", hex_file_path.c_str());
+			return retval;
+		default:
+			break;
+	}
+	printf("Finished parsing %s: %d records.\n", hex_file_path.c_str(), (int)hfp.Image.Count());
+
+	return HEX_SUCCESS;
+}
+
+// Writes a parsed firmware file as a version 1 binary file, or a compressed
+// version 2 file. The byte order of the target device is recorded if given.
+int convert_firmware(string& fw_file, string& bin_file, UpdateOptions& options)
+{
+	CirqueHexFileParser hfp(fw_file);
+	int retval = parse_firmware(hfp, fw_file, options);
+	if (retval != HEX_SUCCESS) return retval;
+
+	if (options.ByteOrder != IMAGE_BYTE_ORDER_UNKNOWN) hfp.ByteOrder = options.ByteOrder;
+	retval = hfp.WriteBin(bin_file, options.CompressBin);
+	if (retval != HEX_SUCCESS)
+	{
+		printf("Could not write %s.\n", bin_file.c_str());
+		return retval;
+	}
+	printf("Wrote %s: %d regions, %d bytes of data.\n", bin_file.c_str(), (int)hfp.Image.Count(), (int)hfp.Image.Bytes());
+	return HEX_SUCCESS;
+}
+
+struct UpdateJob
+{
+	string Device;
+	string Firmware;
+	bool Current = false;
+};
+
+// Checks whether the device already runs the firmware version the file
+// declares. Only the version comment is read from the file, and the device
+// stays in its application.
+bool firmware_is_current(string& hid_device_path, string& hex_file_path)
+{
+	CirqueFirmwareVersion file_version;
+	CirqueHexFileParser hfp(hex_file_path);
+	if (hfp.ReadVersion(file_version) != HEX_SUCCESS)
+	{
+		printf("%s declares no firmware version.\n", hex_file_path.c_str());
+		return false;
+	}
+
+	CirqueBootloaderCollection bl(hid_device_path);
+	CirqueBootloaderStatus status;
+	if (!bl.IsConnected() || bl.GetStatus(status) != BL_SUCCESS || IsBootloader(status.Sentinel) != 0) return false;
+
+	uint16_t vid = 0, pid = 0, ver = 0;
+	uint32_t rev = 0;
+	if (bl.GetVersionInfo(vid, pid, ver, rev) != BL_SUCCESS) return false;
+
+	printf("%s: VID %04X  PID %04X  VER %04X  REV %08X, %s: VID %04X  PID %04X  VER %04X", hid_device_path.c_str(), vid, pid, ver, rev,
+		hex_file_path.c_str(), file_version.VID, file_version.PID, file_version.VER);
+	if (file_version.HasREV) printf("  REV %08X", file_version.REV);
+	printf("\n");
+
+	return vid == file_version.VID && pid == file_version.PID && ver == file_version.VER &&
+		(!file_version.HasREV || rev == file_version.REV);
+}
+
+void write_json_string(FILE* out, string& value)
+{
+	fputc('"', out);
+	for (size_t i = 0; i < value.size(); i++)
+	{
+		if (value[i] == '"' || value[i] == '\\') fputc('\\', out);
+		fputc(value[i], out);
+	}
+	fputc('"', out);
+}
+
+// Prints the command statistics of every updated device, either as tables
+// or as one JSON document, to stdout or to the --stats-file.
+void print_stats(vector<UpdateJob>& jobs, vector<CirqueUpdateSession*>& sessions, UpdateOptions& options)
+{
+	FILE* out = stdout;
+	if (!options.StatsPath.empty())
+	{
+		out = fopen(options.StatsPath.c_str(), "w");
+		if (out == NULL)
+		{
+			printf("Could not open %s for the statistics.\n", options.StatsPath.c_str());
+			return;
+		}
+	}
+
+	if (options.StatsFormat == STATS_JSON)
+		fprintf(out, "{\n  \"version\": \"%s\",\n  \"devices\": [", VERSION);
+
+	bool first = true;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		CirqueUpdateSession* session = sessions[i];
+		if (session == NULL) continue;
+
+		if (options.StatsFormat == STATS_JSON)
+		{
+			fprintf(out, "%s\n    {\n      \"device\": ", first ? "" : ",");
+			write_json_string(out, jobs[i].Device);
+			fprintf(out, ",\n      \"firmware\": ");
+			write_json_string(out, jobs[i].Firmware);
+			fprintf(out, ",\n      \"result\": %d,\n      \"elapsed_us\": %llu,\n", session->Result, (unsigned long long)session->ElapsedUs);
+			session->Stats().PrintJson(out, "      ");
+			fprintf(out, "    }");
+		}
+		else
+		{
+			fprintf(out, "Statistics for %s (%d ms):\n", jobs[i].Device.c_str(), (int)(session->ElapsedUs / 1000));
+			session->Stats().Print(out);
+		}
+		first = false;
+	}
+
+	if (options.StatsFormat == STATS_JSON)
+		fprintf(out, "\n  ]\n}\n");
+	if (out != stdout) fclose(out);
+}
+
+int update_firmware(string& hid_device_path, string& hex_file_path, UpdateOptions& options)
+{
+	if (options.SkipIfCurrent && firmware_is_current(hid_device_path, hex_file_path))
+	{
+		printf("Device firmware is current, nothing to update.\n");
+		return BL_SUCCESS;
+	}
+
+	CirqueHexFileParser hfp(hex_file_path);
+
+	// With --stream, a HEX file is parsed on another thread while the device
+	// is brought into the bootloader and its image formatted, using the
+	// region count and entry point of a quick scan.
+	CirqueImageLayout layout;
+	atomic<int> parse_result(HEX_IN_PROGRESS);
+	thread parser;
+	bool stream = options.StreamParse && options.JournalPath.empty() && !options.Differential;
+	if (stream)
+	{
+		hfp.MaxGapFill = options.MaxGapFill;
+		stream = hfp.ScanLayout(layout) == HEX_SUCCESS;
+		if (!stream) printf("Could not scan %s, parsing it before the update.\n", hex_file_path.c_str());
+	}
+	if (stream)
+	{
+		parser = thread([&]() { parse_result = parse_firmware(hfp, hex_file_path, options); });
+	}
+	else
+	{
+		int retval = parse_firmware(hfp, hex_file_path, options);
+		if( retval != HEX_SUCCESS ) return retval;
+	}
+
+	CirqueUpdateSession session(hid_device_path, hfp, hex_file_path, options);
+	if (stream) session.StreamImage(&layout, &parse_result);
+	if (options.Trace) session.SetTrace(options.Trace, options.Trace->AddTrack(hid_device_path));
+	CirqueEventLoop loop;
+	loop.Add(&session);
+	loop.Run();
+	if (parser.joinable()) parser.join();
+
+	if (options.StatsFormat != STATS_NONE)
+	{
+		vector<UpdateJob> jobs(1);
+		jobs[0].Device = hid_device_path;
+		jobs[0].Firmware = hex_file_path;
+		vector<CirqueUpdateSession*> sessions(1, &session);
+		print_stats(jobs, sessions, options);
+	}
+
+	return session.Result;
+}
+
+// Updates every device at once from one event loop. Each firmware file is
+// parsed once and shared by all the devices that get it.
+int update_devices(vector<UpdateJob>& jobs, UpdateOptions& options)
+{
+	map<string, CirqueHexFileParser*> images;
+	vector<CirqueUpdateSession*> sessions(jobs.size(), NULL);
+	CirqueEventLoop loop;
+	int failed = 0;
+
+	vector<string> files;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		UpdateJob& job = jobs[i];
+		job.Current = options.SkipIfCurrent && firmware_is_current(job.Device, job.Firmware);
+		if (!job.Current && images.find(job.Firmware) == images.end())
+		{
+			images[job.Firmware] = new CirqueHexFileParser(job.Firmware);
+			files.push_back(job.Firmware);
+		}
+	}
+
+	// Parse the firmware files at the same time, each on its own thread and
+	// its own trace track.
+	vector<int> results(files.size());
+	vector<thread> parsers;
+	for (size_t f = 0; f < files.size(); f++)
+	{
+		int track = options.Trace ? options.Trace->AddTrack("Parse " + files[f]) : TRACE_HOST_TRACK;
+		CirqueHexFileParser* hfp = images[files[f]];
+		parsers.push_back(thread([&, f, hfp, track]() { results[f] = parse_firmware(*hfp, files[f], options, track); }));
+	}
+	for (size_t f = 0; f < parsers.size(); f++)
+	{
+		parsers[f].join();
+		if (results[f] != HEX_SUCCESS)
+		{
+			delete images[files[f]];
+			images[files[f]] = NULL;
+		}
+	}
+
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		UpdateJob& job = jobs[i];
+		if (job.Current || images[job.Firmware] == NULL) continue;
+
+		// One journal per device, so the updates don't overwrite each other's progress.
+		UpdateOptions job_options = options;
+		if (!options.JournalPath.empty())
+		{
+			string name = job.Device;
+			for (size_t c = 0; c < name.size(); c++)
+				if (name[c] == '/' || name[c] == ':' || name[c] == ',' || name[c] == '=') name[c] = '_';
+			job_options.JournalPath = options.JournalPath + "." + name;
+		}
+
+		printf("Updating device %s with firmware from %s\n", job.Device.c_str(), job.Firmware.c_str());
+		sessions[i] = new CirqueUpdateSession(job.Device, *images[job.Firmware], job.Firmware, job_options);
+		if (options.Trace) sessions[i]->SetTrace(options.Trace, options.Trace->AddTrack(job.Device));
+		loop.Add(sessions[i]);
+	}
+
+	uint64_t start = CirqueMonotonicUs();
+	loop.Run();
+	uint64_t elapsed = CirqueMonotonicUs() - start;
+
+	printf("Update summary:\n");
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		UpdateJob& job = jobs[i];
+		CirqueUpdateSession* session = sessions[i];
+		if (job.Current)
+			printf("  %-24s %-24s already current\n", job.Device.c_str(), job.Firmware.c_str());
+		else if (session == NULL)
+			printf("  %-24s %-24s not updated, firmware file could not be parsed\n", job.Device.c_str(), job.Firmware.c_str());
+		else if (session->Result == BL_SUCCESS)
+			printf("  %-24s %-24s updated in %d ms\n", job.Device.c_str(), job.Firmware.c_str(), (int)(session->ElapsedUs / 1000));
+		else
+			printf("  %-24s %-24s failed with %d after %d ms\n", job.Device.c_str(), job.Firmware.c_str(), session->Result, (int)(session->ElapsedUs / 1000));
+		if (!job.Current && (session == NULL || session->Result != BL_SUCCESS)) failed++;
+	}
+	printf("%d of %d devices up to date after %d ms.\n", (int)jobs.size() - failed, (int)jobs.size(), (int)(elapsed / 1000));
+	if (options.StatsFormat != STATS_NONE) print_stats(jobs, sessions, options);
+
+	for (size_t i = 0; i < sessions.size(); i++)
+		delete sessions[i];
+	for (map<string, CirqueHexFileParser*>::iterator it = images.begin(); it != images.end(); ++it)
+		delete it->second;
+
+	return failed ? BL_FAILURE : BL_SUCCESS;
+}
+
+// Checks the vector hex decoder against the scalar one, then times both on
+// the data of the parsed image written out as hex digits.
+int benchmark_decoders(CirqueFirmwareImage& image)
+{
+	const int runs = 5;
+	int mismatches = CirqueHexDecoder::SelfCheck();
+	if (mismatches != 0)
+	{
+		printf("The %s hex decoder disagrees with the scalar decoder %d times.\n", CirqueHexDecoder::Name(), mismatches);
+		return HEX_CORRUPT;
+	}
+
+	static const char digits[] = "0123456789ABCDEF";
+	vector<uint8_t> text, out;
+	for (size_t i = 0; i < image.Count(); i++)
+	{
+		CirqueImageRegion region = image[i];
+		for (size_t j = 0; j < region.Size; j++)
+		{
+			text.push_back(digits[region.Data[j] >> 4]);
+			text.push_back(digits[region.Data[j] & 0x0F]);
+		}
+	}
+	size_t pairs = text.size() / 2;
+	if (pairs == 0) return HEX_SUCCESS;
+	out.resize(pairs);
+
+	string names[2] = { "scalar decoder", string(CirqueHexDecoder::Name()) + " decoder" };
+	uint64_t best[2] = { UINT64_MAX, UINT64_MAX };
+	for (int run = 0; run < runs; run++)
+	{
+		for (int decoder = 0; decoder < 2; decoder++)
+		{
+			uint8_t sum = 0;
+			uint64_t start = CirqueMonotonicUs();
+			size_t count = decoder ? CirqueHexDecoder::Decode(&text[0], pairs, &out[0], sum)
+				: CirqueHexDecoder::DecodeScalar(&text[0], pairs, &out[0], sum);
+			uint64_t elapsed = CirqueMonotonicUs() - start;
+			if (count != pairs) return HEX_CORRUPT;
+			if (elapsed < best[decoder]) best[decoder] = elapsed;
+		}
+	}
+
+	for (int decoder = 0; decoder < 2; decoder++)
+	{
+		printf("  %-15s %8.2f ms  %8.1f MB/s\n", names[decoder].c_str(), best[decoder] / 1000.0,
+			best[decoder] ? (double)text.size() / best[decoder] : 0.0);
+	}
+	return HEX_SUCCESS;
+}
+
+// Parses a HEX file with the mapped parser and with the original line
+// parser, checks that both give the same regions and prints the best time
+// of each over a few runs.
+int benchmark_parsers(string& hex_file_path)
+{
+	const int runs = 5;
+	struct stat st;
+	if (stat(hex_file_path.c_str(), &st) != 0)
+	{
+		printf("Firmware file %s does not exist.\n", hex_file_path.c_str());
+		return HEX_NOFILE;
+	}
+
+	CirqueHexFileParser lines(hex_file_path), mapped(hex_file_path);
+	int retval = lines.ParseLines();
+	if (retval != HEX_SUCCESS || (retval = mapped.ParseMapped()) != HEX_SUCCESS)
+	{
+		printf("Firmware file %s is corrupted.\n", hex_file_path.c_str());
+		return retval;
+	}
+	if (lines.Image != mapped.Image)
+	{
+		printf("The parsers disagree on %s.\n", hex_file_path.c_str());
+		return HEX_CORRUPT;
+	}
+	printf("%s: %lld bytes of text, %d regions, %d bytes of data.\n", hex_file_path.c_str(), (long long)st.st_size, (int)mapped.Image.Count(), (int)mapped.Image.Bytes());
+
+	unsigned threads = thread::hardware_concurrency();
+	if (threads < 2) threads = 2;
+	CirqueHexFileParser parallel(hex_file_path);
+	if (parallel.ParseParallel(threads) != HEX_SUCCESS || parallel.Image != mapped.Image)
+	{
+		printf("The parallel parser disagrees on %s.\n", hex_file_path.c_str());
+		return HEX_CORRUPT;
+	}
+
+	const char* names[3] = { "line parser", "mapped parser", "parallel parser" };
+	uint64_t best[3] = { UINT64_MAX, UINT64_MAX, UINT64_MAX };
+	for (int run = 0; run < runs; run++)
+	{
+		for (int parser = 0; parser < 3; parser++)
+		{
+			CirqueHexFileParser hfp(hex_file_path);
+			uint64_t start = CirqueMonotonicUs();
+			if (parser == 0) hfp.ParseLines();
+			else if (parser == 1) hfp.ParseMapped();
+			else hfp.ParseParallel(threads);
+			uint64_t elapsed = CirqueMonotonicUs() - start;
+			if (elapsed < best[parser]) best[parser] = elapsed;
+		}
+	}
+
+	for (int parser = 0; parser < 3; parser++)
+	{
+		printf("  %-15s %8.2f ms  %8.1f MB/s", names[parser], best[parser] / 1000.0,
+			best[parser] ? (double)st.st_size / best[parser] : 0.0);
+		if (parser == 2) printf("  %u threads", threads);
+		printf("\n");
+	}
+
+	return benchmark_decoders(mapped.Image);
+}
+
+bool parse_option(char * arg, UpdateOptions& options)
+{
+	if (strcmp(arg, "--write-mode=sequential") == 0)
+		options.PipelinedWrites = false;
+	else if (strcmp(arg, "--write-mode=pipelined") == 0)
+		options.PipelinedWrites = true;
+	else if (strncmp(arg, "--write-window=", 15) == 0)
+		options.WriteWindow = strtoul(arg + 15, NULL, 0);
+	else if (strcmp(arg, "--differential") == 0)
+		options.Differential = true;
+	else if (strncmp(arg, "--journal=", 10) == 0)
+		options.JournalPath = arg + 10;
+	else if (strcmp(arg, "--all") == 0)
+		options.AllDevices = true;
+	else if (strcmp(arg, "--skip-if-current") == 0)
+		options.SkipIfCurrent = true;
+	else if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0)
+		options.StatsFormat = STATS_TEXT;
+	else if (strcmp(arg, "--stats=json") == 0)
+		options.StatsFormat = STATS_JSON;
+	else if (strncmp(arg, "--stats-file=", 13) == 0)
+		options.StatsPath = arg + 13;
+	else if (strncmp(arg, "--trace=", 8) == 0)
+		options.TracePath = arg + 8;
+	else if (strncmp(arg, "--parse-threads=", 16) == 0)
+		options.ParseThreads = strtoul(arg + 16, NULL, 0);
+	else if (strncmp(arg, "--fill-gaps=", 12) == 0)
+		options.MaxGapFill = strtoul(arg + 12, NULL, 0);
+	else if (strcmp(arg, "--byte-order=little") == 0)
+		options.ByteOrder = IMAGE_BYTE_ORDER_LITTLE;
+	else if (strcmp(arg, "--byte-order=big") == 0)
+		options.ByteOrder = IMAGE_BYTE_ORDER_BIG;
+	else if (strcmp(arg, "--compress") == 0)
+		options.CompressBin = true;
+	else if (strcmp(arg, "--stream") == 0)
+		options.StreamParse = true;
+	else if (strncmp(arg, "--cache=", 8) == 0)
+		options.CacheDir = arg + 8;
+	else if (strncmp(arg, "--cache-size=", 13) == 0)
+		options.CacheBytes = strtoull(arg + 13, NULL, 0) * 1024 * 1024;
+	else
+		return false;
+	return true;
+}
+
+int main (int argc, char * argv[])
+{
+	string device, fw_file;
+	UpdateOptions options;
+	int ret = 0;
+
+	// Take out the long options, the other arguments keep their order.
+	int count = 1;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "--", 2) != 0)
+		{
+			argv[count++] = argv[i];
+		}
+		else if (!parse_option(argv[i], options))
+		{
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+	}
+	argc = count;
+
+	CirqueTraceLog trace_log;
+	if (!options.TracePath.empty())
+	{
+		options.Trace = &trace_log;
+		trace_log.AddTrack("Host");
+	}
+
+	if( argc > 1 && strcmp( argv[1], "-r" ) == 0 )
+	{
+		vector<string> devices;
+
+		if (argc < 3)
+		{
+			devices = find_cirque_devices();
+		}
+		else
+		{
+			devices.push_back(string(argv[2]));
+		}
+		
+		for(int i = 0; i < devices.size(); ++i)
+		{
+			printf("Querying device %s\n", devices[i].c_str());
+			dump_raw_data(devices[i], options.Trace);
+		}
+		if (options.Trace) options.Trace->Write(options.TracePath);
+
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "-l") == 0)
+	{
+		vector<string> devices;
+
+		if (argc < 3)
+		{
+			devices = find_cirque_devices();
+		}
+		else
+		{
+			devices.push_back(string(argv[2]));
+		}
+
+		printf("Available devices:\n");
+		for (int i = 0; i < devices.size(); ++i)
+		{
+			get_device_attributes(devices[i]);
+		}
+
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "-v") == 0)
+	{
+		printf("Cirque touchpad firmware updater %s (%s)\n%s\n", VERSION, DATE, COPYRIGHT);
+
+		return 0;
+	}
+
+	if (argc == 4 && strcmp(argv[1], "-c") == 0)
+	{
+		string fw_file = argv[2];
+		string bin_file = argv[3];
+		return convert_firmware(fw_file, bin_file, options);
+	}
+
+	if (argc == 3 && strcmp(argv[1], "-b") == 0)
+	{
+		fw_file = argv[2];
+		return benchmark_parsers(fw_file);
+	}
+
+	// Update several devices in parallel, either every Cirque device from
+	// one firmware file or a list of firmware/device pairs.
+	if( ( options.AllDevices && argc == 2 ) || ( argc >= 5 && argc % 2 == 1 ) )
+	{
+		vector<UpdateJob> jobs;
+		if( options.AllDevices )
+		{
+			vector<string> devices = find_cirque_devices();
+			jobs.resize(devices.size());
+			for (size_t i = 0; i < devices.size(); i++)
+			{
+				jobs[i].Device = devices[i];
+				jobs[i].Firmware = argv[1];
+			}
+		}
+		else
+		{
+			jobs.resize((argc - 1) / 2);
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				jobs[i].Firmware = argv[1 + 2 * i];
+				jobs[i].Device = argv[2 + 2 * i];
+				for (size_t j = 0; j < i; j++)
+				{
+					if (jobs[j].Device == jobs[i].Device)
+					{
+						printf("Device %s is listed more than once.\n", jobs[i].Device.c_str());
+						return -1;
+					}
+				}
+			}
+		}
+		if (jobs.empty())
+		{
+			printf("No Cirque devices found.\n");
+			return -1;
+		}
+
+		vector<mode_t> modes(jobs.size(), 020660);
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			struct stat mode;
+			mode.st_mode = 020660;
+			stat( jobs[i].Device.c_str(), &mode );
+			modes[i] = mode.st_mode;
+			chmod( jobs[i].Device.c_str(), mode.st_mode | S_IROTH | S_IWOTH );
+		}
+		ret = update_devices(jobs, options);
+		if (options.Trace) options.Trace->Write(options.TracePath);
+		for (size_t i = 0; i < jobs.size(); i++)
+			chmod( jobs[i].Device.c_str(), modes[i] );
+		return ret;
+	}
+
+	switch( argc )
+	{
+		case 3:
+			struct stat mode;
+			mode.st_mode = 020660;
+			stat( argv[2], &mode );
+			chmod( argv[2], mode.st_mode | S_IROTH | S_IWOTH );
+			device = argv[2];
+			if( strcmp( argv[1], "-a" ) == 0 )
+			{
+				// Get and output the version number.
+				// Suppress all standard output temporarily.
+				int fd = dup(1);
+				close(1);
+				uint16_t ver = 0;
+				ret = get_fw_version(device, ver);
+				// Resume standard output.
+				fflush(stdout);
+				dup2(fd, 1);
+				close(fd);
+				if(ret == 0) printf("%02X.%02X\n", ver >> 8, ver & 0xFF);
+				return ret;
+			}
+			else if( strcmp( argv[1], "-n" ) == 0 )
+			{
+				// Get the version number.
+				printf("Querying device %s\n", device.c_str());
+				ret = get_device_attributes(device);
+			}
+			else
+			{
+				// Update firmware.
+				fw_file = argv[1];
+				printf("Updating device %s with firmware from %s\n", device.c_str(), fw_file.c_str());
+				ret = update_firmware(device, fw_file, options);
+				if (options.Trace) options.Trace->Write(options.TracePath);
+				if(ret != BL_SUCCESS)
+					printf("Firmware update failed.\n");
+			}
+			chmod( argv[2], mode.st_mode );
+			return ret;
+		default:
+			printf("To update firmware, enter:\n");
+			printf("  sudo %s [options] <firmware_filepath> <device_filepath>\n", argv[0]);
+			printf("To update several devices in parallel, enter:\n");
+			printf("  sudo %s [options] <firmware_filepath> <device_filepath> <firmware_filepath> <device_filepath> ...\n", argv[0]);
+			printf("  sudo %s [options] --all <firmware_filepath>\n", argv[0]);
+			printf("Firmware files can be Intel HEX, binary (see -c) or little-endian ELF32 files.\n");
+			printf("Update options:\n");
+			printf("  --write-mode=sequential|pipelined  check the status after every payload or once per window\n");
+			printf("  --write-window=<n>                 payloads per status check in pipelined mode, 0 for one per region\n");
+			printf("  --differential                     skip the update if the device already holds the image, skip erased pages\n");
+			printf("  --journal=<file>                   record progress in a file and resume an interrupted update from it\n");
+			printf("  --all                              update every Cirque device found\n");
+			printf("  --skip-if-current                  don't update if the device runs the version the firmware file declares\n");
+			printf("  --stats[=text|json]                print the latency of every command type after the update\n");
+			printf("  --stats-file=<file>                write the statistics to a file instead of the standard output\n");
+			printf("  --trace=<file>                     write a timeline of the update or data dump for chrome://tracing or Perfetto\n");
+			printf("  --parse-threads=<n>                threads for parsing a HEX file, 0 to choose from its size\n");
+			printf("  --fill-gaps=<bytes>                join regions at most this far apart, padding with 0xFF\n");
+			printf("  --stream                           parse a HEX file while the device is prepared, with one device and no journal\n");
+			printf("  --cache=<dir>                      keep parsed HEX files in a directory and load them from there while unchanged\n");
+			printf("  --cache-size=<MB>                  bound of the cache, 64 MB by default\n");
+			printf("To find the device path, list all available devices by running:\n");
+			printf("  sudo %s -l\n", argv[0]);
+			printf("To get the version of this firmware update tool, enter:\n");
+			printf("  sudo %s -v\n", argv[0]);
+			printf("To convert a firmware file to the binary format, which loads without parsing, enter:\n");
+			printf("  %s [--fill-gaps=<bytes>] [--byte-order=little|big] [--compress] -c <firmware_filepath> <binary_filepath>\n", argv[0]);
+			printf("To compare the speed of the HEX file parsers on a firmware file, enter:\n");
+			printf("  %s -b <firmware_filepath>\n", argv[0]);
+			printf("To run against the bootloader emulator, use a device path of the form:\n");
+			printf("  emu[:be,bl,legacy,nodelay,busy=<percent>,i2c=<kHz>,drop=<n>,abort=<n>,switch=<ms>,version=<n>,ver=<hex>,pid=<hex>,state=<file>]\n");
+			return -1;
+	}
+	
+	return 0;
+}
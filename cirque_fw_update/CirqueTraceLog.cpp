@@ -0,0 +1,93 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueTraceLog.h"
+#include "CirqueTiming.h"
+
+CirqueTraceLog::CirqueTraceLog()
+{
+	this->origin_us = CirqueMonotonicUs();
+}
+
+int CirqueTraceLog::AddTrack( const string& name )
+{
+	lock_guard<mutex> guard( this->lock );
+	this->tracks.push_back( name );
+	return (int)this->tracks.size();
+}
+
+int CirqueTraceLog::Begin( int track, const string& name )
+{
+	lock_guard<mutex> guard( this->lock );
+	TraceSpan span;
+	span.Name = name;
+	span.Track = track;
+	span.StartUs = CirqueMonotonicUs() - this->origin_us;
+	span.EndUs = 0;
+	this->spans.push_back( span );
+	return (int)this->spans.size() - 1;
+}
+
+void CirqueTraceLog::End( int span )
+{
+	lock_guard<mutex> guard( this->lock );
+	if( span < 0 || span >= (int)this->spans.size() ) return;
+	this->spans[span].EndUs = CirqueMonotonicUs() - this->origin_us;
+}
+
+void CirqueTraceLog::PrintString( FILE* out, const string& value )
+{
+	fputc( '"', out );
+	for( size_t i = 0; i < value.size(); i++ )
+	{
+		if( value[i] == '"' || value[i] == '\\' ) fputc( '\\', out );
+		fputc( value[i], out );
+	}
+	fputc( '"', out );
+}
+
+int CirqueTraceLog::Write( const string& path )
+{
+	FILE* out = fopen( path.c_str(), "w" );
+	if( out == NULL )
+	{
+		printf( "CirqueTraceLog::Write: could not open %s\n", path.c_str() );
+		return -1;
+	}
+
+	uint64_t now = CirqueMonotonicUs() - this->origin_us;
+	fprintf( out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+	fprintf( out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"cirque_touch_fw_update\"}}" );
+	for( size_t i = 0; i < this->tracks.size(); i++ )
+	{
+		fprintf( out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", (int)i + 1 );
+		PrintString( out, this->tracks[i] );
+		fprintf( out, "}}" );
+	}
+	for( size_t i = 0; i < this->spans.size(); i++ )
+	{
+		TraceSpan& span = this->spans[i];
+		uint64_t end = ( span.EndUs != 0 ) ? span.EndUs : now;
+		fprintf( out, ",\n{\"name\": " );
+		PrintString( out, span.Name );
+		fprintf( out, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %llu, \"dur\": %llu}", span.Track,
+			(unsigned long long)span.StartUs, (unsigned long long)( end - span.StartUs ) );
+	}
+	fprintf( out, "\n]}\n" );
+	fclose( out );
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_TRACE_LOG_H__
+#define __CIRQUE_TRACE_LOG_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+
+using namespace std;
+
+// Collects timed spans and writes them as a trace-event JSON file for
+// chrome://tracing or Perfetto. Each track shows up as its own thread, so
+// a multi-device run gets one row per device. Spans may be recorded from
+// several threads.
+class CirqueTraceLog
+{
+	private:
+	struct TraceSpan
+	{
+		string Name;
+		int Track;
+		uint64_t StartUs;
+		uint64_t EndUs;
+	};
+
+	vector<TraceSpan> spans;
+	vector<string> tracks;
+	uint64_t origin_us;
+	mutex lock;
+
+	static void PrintString( FILE* out, const string& value );
+
+	public:
+	CirqueTraceLog();
+
+	int AddTrack( const string& name );
+	// Begin returns the span to pass to End. Spans left open are closed
+	// when the file is written.
+	int Begin( int track, const string& name );
+	void End( int span );
+	int Write( const string& path );
+};
+
+#endif //__CIRQUE_TRACE_LOG_H__
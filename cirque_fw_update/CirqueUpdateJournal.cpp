@@ -0,0 +1,157 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "CirqueUpdateJournal.h"
+
+CirqueUpdateJournal::CirqueUpdateJournal( string& JournalPath, string& DevicePath, const CirqueFirmwareImage& image )
+{
+	path = JournalPath;
+	device_path = DevicePath;
+	image_hash = JournalPath.empty() ? 0 : ImageHash( image );
+}
+
+uint64_t CirqueUpdateJournal::ImageHash( const CirqueFirmwareImage& image )
+{
+	// FNV-1a over the region addresses, sizes and data.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for( size_t i = 0; i < image.Count(); i++ )
+	{
+		CirqueImageRegion region = image[i];
+		uint32_t header[2] = { region.Address, region.Size };
+		const uint8_t* bytes = (const uint8_t*)header;
+		for( size_t j = 0; j < sizeof( header ); j++ )
+			hash = ( hash ^ bytes[j] ) * 0x100000001b3ULL;
+		// A page at a time, so compressed images are never held decompressed.
+		for( uint32_t offset = 0; offset < region.Size; offset += 4096 )
+		{
+			uint32_t length = ( region.Size - offset < 4096 ) ? region.Size - offset : 4096;
+			const uint8_t* data = image.View( i, offset, length );
+			if( data == NULL ) break;
+			for( uint32_t j = 0; j < length; j++ )
+				hash = ( hash ^ data[j] ) * 0x100000001b3ULL;
+		}
+	}
+	return hash;
+}
+
+string CirqueUpdateJournal::BootId()
+{
+	string id;
+	ifstream file( "/proc/sys/kernel/random/boot_id" );
+	if( file.is_open() ) getline( file, id );
+	return id;
+}
+
+int CirqueUpdateJournal::Load()
+{
+	ifstream file( path );
+	if( !file.is_open() ) return JOURNAL_NONE;
+
+	string line, journal_device, journal_boot;
+	uint64_t journal_hash = 0;
+	long journal_pid = 0;
+	bool complete = false;
+
+	while( getline( file, line ) )
+	{
+		size_t equals = line.find( '=' );
+		if( equals == string::npos ) continue;
+		string key = line.substr( 0, equals );
+		string value = line.substr( equals + 1 );
+
+		if( key == "image" ) journal_hash = strtoull( value.c_str(), NULL, 16 );
+		else if( key == "device" ) journal_device = value;
+		else if( key == "pid" ) journal_pid = strtol( value.c_str(), NULL, 10 );
+		else if( key == "boot" ) journal_boot = value;
+		else if( key == "endian" ) BigEndian = strtol( value.c_str(), NULL, 10 );
+		else if( key == "region" ) Region = (uint8_t)strtoul( value.c_str(), NULL, 10 );
+		else if( key == "offset" ) Offset = strtoul( value.c_str(), NULL, 10 );
+		else if( key == "end" ) complete = true;
+	}
+
+	// A journal cut short by a crash while saving is useless.
+	if( !complete || journal_hash != image_hash || journal_device != device_path ) return JOURNAL_NONE;
+
+	// The process that wrote the journal may still be updating the device.
+	if( journal_pid != getpid() && journal_boot == BootId() && kill( (pid_t)journal_pid, 0 ) == 0 )
+	{
+		printf( "Update journal %s belongs to running process %ld.\n", path.c_str(), journal_pid );
+		return JOURNAL_BUSY;
+	}
+
+	return JOURNAL_RESUME;
+}
+
+int CirqueUpdateJournal::Save()
+{
+	// Write a new file and rename it over the old one so a crash leaves
+	// either the previous or the new journal.
+	string temp = path + ".tmp";
+	FILE* file = fopen( temp.c_str(), "w" );
+	if( file == NULL )
+	{
+		printf( "Could not write update journal %s.\n", temp.c_str() );
+		return -1;
+	}
+
+	fprintf( file, "image=%016llx\n", (unsigned long long)image_hash );
+	fprintf( file, "device=%s\n", device_path.c_str() );
+	fprintf( file, "pid=%ld\n", (long)getpid() );
+	fprintf( file, "boot=%s\n", BootId().c_str() );
+	fprintf( file, "endian=%d\n", BigEndian );
+	fprintf( file, "region=%d\n", Region );
+	fprintf( file, "offset=%u\n", Offset );
+	fprintf( file, "end=1\n" );
+	fflush( file );
+	fsync( fileno( file ) );
+	fclose( file );
+
+	unsaved = 0;
+	return rename( temp.c_str(), path.c_str() );
+}
+
+void CirqueUpdateJournal::Remove()
+{
+	unlink( path.c_str() );
+}
+
+void CirqueUpdateJournal::Start( int IsBigEndian )
+{
+	BigEndian = IsBigEndian;
+	Region = 0;
+	Offset = 0;
+	Save();
+}
+
+void CirqueUpdateJournal::Verified( uint8_t VerifiedRegion, uint32_t VerifiedOffset )
+{
+	unsaved += ( VerifiedRegion != Region ) ? VerifiedOffset : VerifiedOffset - Offset;
+	Region = VerifiedRegion;
+	Offset = VerifiedOffset;
+
+	if( unsaved >= JOURNAL_SAVE_INTERVAL ) Save();
+}
+
+bool CirqueUpdateJournal::IsWritten( uint8_t ChunkRegion, uint32_t ChunkOffset )
+{
+	return ChunkRegion < Region || ( ChunkRegion == Region && ChunkOffset < Offset );
+}
@@ -0,0 +1,63 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_UPDATE_JOURNAL_H__
+#define __CIRQUE_UPDATE_JOURNAL_H__
+
+#include <string>
+#include <vector>
+#include "CirqueFirmwareImage.h"
+
+using namespace std;
+
+#define JOURNAL_NONE   (0)
+#define JOURNAL_RESUME (1)
+#define JOURNAL_BUSY   (2)
+
+// Records how far an update has got, so an interrupted update can carry on
+// writing instead of starting over. The journal is written once the image
+// is formatted, then after every JOURNAL_SAVE_INTERVAL verified bytes and
+// at the end of each region, and removed once the image validates.
+class CirqueUpdateJournal
+{
+private:
+	static const uint32_t JOURNAL_SAVE_INTERVAL = 8192;
+
+	string path;
+	string device_path;
+	uint64_t image_hash;
+	uint32_t unsaved = 0;
+
+	static string BootId();
+
+public:
+	int BigEndian = 0;
+	uint8_t Region = 0;
+	uint32_t Offset = 0;
+
+	CirqueUpdateJournal( string& JournalPath, string& DevicePath, const CirqueFirmwareImage& image );
+	int Load();
+	int Save();
+	void Remove();
+
+	void Start( int IsBigEndian );
+	void Verified( uint8_t VerifiedRegion, uint32_t VerifiedOffset );
+	bool IsWritten( uint8_t ChunkRegion, uint32_t ChunkOffset );
+
+	static uint64_t ImageHash( const CirqueFirmwareImage& image );
+};
+
+#endif //__CIRQUE_UPDATE_JOURNAL_H__
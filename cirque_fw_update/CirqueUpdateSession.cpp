@@ -0,0 +1,797 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CirqueUpdateSession.h"
+#include "CirqueTiming.h"
+#include <cstring>
+
+CirqueUpdateSession::CirqueUpdateSession( string& hid_device_path, CirqueHexFileParser& hex_file, string& hex_file_path, UpdateOptions& update_options )
+	: bl( hid_device_path ), hfp( hex_file ), device_path( hid_device_path ), hex_file_path( hex_file_path ), options( update_options ),
+	  update_journal( options.JournalPath, device_path, hfp.Image )
+{
+	journal = options.JournalPath.empty() ? NULL : &update_journal;
+	pacer.NsPerByte = 0;
+	pacer.MinNsPerByte = 0;
+}
+
+CirqueUpdateSession::~CirqueUpdateSession()
+{
+	delete plan;
+}
+
+int64_t CirqueUpdateSession::Step()
+{
+	if( IsFinished() ) return -1;
+
+	if( waiting )
+	{
+		uint32_t next_poll = 0;
+		int retval = bl.PollCompletion( status, next_poll );
+		if( retval == BL_IN_PROGRESS )
+		{
+			bl.Stats.SleepUs += next_poll;
+			return next_poll;
+		}
+		waiting = false;
+		wait_result = retval;
+	}
+
+	uint32_t delay = Advance();
+	if( IsFinished() )
+	{
+		ElapsedUs = CirqueMonotonicUs() - start_time;
+		return -1;
+	}
+	bl.Stats.SleepUs += delay;
+	return delay;
+}
+
+// retval is the result of sending a command. On success the session waits
+// for the command to complete, and for the device to answer in mode if one
+// is given, and then continues in next_state.
+uint32_t CirqueUpdateSession::Issue( int retval, uint32_t DelayUs, UpdateState next_state, int mode )
+{
+	if( retval != BL_SUCCESS ) return Finish( retval );
+
+	state = next_state;
+	waiting = true;
+	return bl.StartWait( DelayUs, mode );
+}
+
+uint32_t CirqueUpdateSession::Finish( int retval )
+{
+	EndSpan( burst_span );
+	EndSpan( region_span );
+	EndSpan( phase_span );
+	EndSpan( update_span );
+	Result = retval;
+	state = ( retval == BL_SUCCESS ) ? UPDATE_DONE : UPDATE_FAILED;
+	return 0;
+}
+
+void CirqueUpdateSession::BeginSpan( int& span, const string& name )
+{
+	if( bl.Trace ) span = bl.Trace->Begin( bl.TraceTrack, name );
+}
+
+void CirqueUpdateSession::EndSpan( int& span )
+{
+	if( bl.Trace && span >= 0 ) bl.Trace->End( span );
+	span = -1;
+}
+
+uint32_t CirqueUpdateSession::Advance()
+{
+	switch( state )
+	{
+		case UPDATE_START:         return Start();
+		case UPDATE_STATUS:        return ReadStatus();
+		case UPDATE_CLEAR_ERROR:   return ErrorCleared();
+		case UPDATE_INVOKE:        return Invoked();
+		case UPDATE_PARSE:         return ImageParsed();
+		case UPDATE_PROBE_FORMAT_IMAGE:  return ProbeImageFormatted();
+		case UPDATE_PROBE_FORMAT_REGION: return ProbeRegionFormatted();
+		case UPDATE_PROBE_WRITE:         return ProbeWritten();
+		case UPDATE_PROBE_FLUSH:         return ProbeFlushed();
+		case UPDATE_PROBE_VALIDATE:      return ProbeValidated();
+		case UPDATE_PROBE_CLEAR_ERROR:   return ProbeErrorCleared();
+		case UPDATE_FORMAT_IMAGE:  return ImageFormatted();
+		case UPDATE_FORMAT_REGION: return RegionFormatted();
+		case UPDATE_WRITE:         return Written();
+		case UPDATE_WRITE_PACE:    return Paced();
+		case UPDATE_WRITE_WINDOW:  return WindowChecked();
+		case UPDATE_WRITE_SETTLE:  return ( wait_result == BL_SUCCESS ) ? ClearWriteError() : Finish( BL_FAILURE );
+		case UPDATE_WRITE_CLEAR_ERROR: return Rewind();
+		case UPDATE_FLUSH:         return Flushed();
+		case UPDATE_VALIDATE:      return Validated();
+		case UPDATE_RESET:         return ResetDone();
+		default:                   return 0;
+	}
+}
+
+// Reads the image regions back from the device and counts the pages that
+// differ from the firmware file. Returns a negative value if a read fails.
+// The device runs its application, so reads are kept to what it answers.
+int CirqueUpdateSession::CountDifferingPages()
+{
+	int differing = 0;
+	vector<uint8_t> readback;
+
+	for (size_t i = 0; i < hfp.Image.Count(); i++)
+	{
+		CirqueImageRegion image_region = hfp.Image[i];
+		uint32_t size = image_region.Size;
+		readback.resize(size);
+		if (bl.BulkRead(image_region.Address, readback.data(), size, CirqueBootloaderCollection::MAX_APP_READ_PAYLOAD) != BL_SUCCESS) return BL_READ_ERROR;
+
+		int pages = 0, changed = 0;
+		for (uint32_t offset = 0; offset < size; offset += DIFF_PAGE_SIZE)
+		{
+			uint32_t length = (size - offset > DIFF_PAGE_SIZE) ? DIFF_PAGE_SIZE : size - offset;
+			pages++;
+			const uint8_t* data = hfp.Image.View(i, offset, length);
+			if (data == NULL || memcmp(&readback[offset], data, length) != 0) changed++;
+		}
+		printf("Region %d at 0x%08X: %d of %d pages differ.\n", (int)i, image_region.Address, changed, pages);
+		differing += changed;
+	}
+
+	return differing;
+}
+
+uint32_t CirqueUpdateSession::Start()
+{
+	start_time = CirqueMonotonicUs();
+	BeginSpan( update_span, "Update" );
+	if( !bl.IsConnected() ) return Finish( BL_FAILURE );
+
+	// Sanity check to get the endianness.
+	BeginSpan( phase_span, "SanityCheck" );
+	bool sane = bl.SanityCheck();
+	EndSpan( phase_span );
+	if( !sane )
+	{
+		// We couldn't get endianness. We may be in bootloader mode.
+		// Assume the firmware is little-endian and try it.
+		// If it fails, we'll try big-endian.
+		bl.IS_BIG_ENDIAN = 0;
+		retry = 1;
+		printf("Sanity check failed.\n");
+		// A binary firmware file may name the byte order, which saves the
+		// probe. Only HEX files are parsed while the update runs.
+		if( parse_result == NULL && hfp.ByteOrder != IMAGE_BYTE_ORDER_UNKNOWN )
+		{
+			bl.IS_BIG_ENDIAN = ( hfp.ByteOrder == IMAGE_BYTE_ORDER_BIG );
+			probed = true;
+			printf("Using the %s-endian byte order the firmware file declares.\n", bl.IS_BIG_ENDIAN ? "big" : "little");
+		}
+	}
+
+	// A running application whose flash already holds this image needs no update.
+	if( options.Differential && !retry )
+	{
+		BeginSpan( phase_span, "Differential readback" );
+		int differing = CountDifferingPages();
+		EndSpan( phase_span );
+		if( differing == 0 )
+		{
+			printf("Device firmware already matches %s, nothing to update.\n", hex_file_path.c_str());
+			return Finish( BL_SUCCESS );
+		}
+		if( differing < 0 ) printf("Reading back the device image failed, updating everything.\n");
+	}
+
+	// An interrupted update of this image can carry on where it stopped.
+	journal_state = journal ? journal->Load() : JOURNAL_NONE;
+	if( journal_state == JOURNAL_BUSY ) return Finish( BL_FAILURE );
+
+	state = UPDATE_STATUS;
+	return 0;
+}
+
+uint32_t CirqueUpdateSession::ReadStatus()
+{
+	// Get timing values.
+	ResetDelay = 100;
+	FormatImageDelay = 100;
+	FormatRegionsPageDelay = 50;
+	PageWriteDelay = 10;
+	FlushDelay = 10;
+
+	int retval = bl.GetStatus( status );
+	printf("GetStatus returned %d.\n", retval);
+	if( retval != BL_SUCCESS ) return Finish( retval );
+
+	printf( "Status: Sentinel 0x%04X Version 0x%02X Error %d\n", status.Sentinel, status.Version, status.LastError );
+
+	// Resuming only makes sense while the bootloader still holds the
+	// formatted image. A device that is back in the application, or
+	// reports an error, gets a full update.
+	resuming = journal_state == JOURNAL_RESUME && IsBootloader(status.Sentinel) == 1 && status.LastError == NV_err_none;
+	journal_state = JOURNAL_NONE;
+	if( resuming )
+	{
+		printf("Resuming the update at region %d offset 0x%X.\n", journal->Region, journal->Offset);
+		bl.IS_BIG_ENDIAN = journal->BigEndian;
+		retry = 0;
+	}
+
+	if( status.LastError != NV_err_none )
+	{
+		// Clear the error and retry. The device only leaves the bootloader
+		// if it holds a valid image.
+		BeginSpan( phase_span, "Reset" );
+		retval = bl.Reset();
+		printf("Reset returned %d.\n", retval);
+		return Issue( retval, ResetDelay * 1000, UPDATE_CLEAR_ERROR, status.bImageValid ? 0 : -1 );
+	}
+
+	return EnterBootloader();
+}
+
+uint32_t CirqueUpdateSession::ErrorCleared()
+{
+	EndSpan( phase_span );
+	// Check status.
+	if( wait_result == BL_MODE_TIMEOUT )
+	{
+		printf("The device didn't start its application after the reset.\n");
+		return Finish( wait_result );
+	}
+	if( !Completed() )
+	{
+		printf("GetStatus after reset failed with error %d.\n", status.LastError);
+		return Finish( BL_FAILURE );
+	}
+
+	return EnterBootloader();
+}
+
+uint32_t CirqueUpdateSession::EnterBootloader()
+{
+	// Invoke bootloader.
+	if( IsBootloader(status.Sentinel) == 0 )
+	{
+		BeginSpan( phase_span, "Invoke" );
+		int retval = bl.Invoke();
+		printf("Invoke bootloader returned %d.\n", retval);
+		return Issue( retval, ResetDelay * 1000, UPDATE_INVOKE, 1 );
+	}
+
+	return FormatImage();
+}
+
+uint32_t CirqueUpdateSession::Invoked()
+{
+	EndSpan( phase_span );
+	printf("GetStatus returned %d.\n", wait_result);
+	if( wait_result == BL_MODE_TIMEOUT ) printf("The device didn't enter bootloader mode.\n");
+	if( wait_result != BL_SUCCESS ) return Finish( wait_result );
+
+	printf( "Status: Sentinel 0x%04X Version 0x%02X Error %d\n", status.Sentinel, status.Version, status.LastError );
+
+	return FormatImage();
+}
+
+uint32_t CirqueUpdateSession::FormatImage()
+{
+	if( status.Version >= 0x08)
+	{
+		FormatRegionsPageDelay = status.RegionFormatDelayMsPer1K;
+		PageWriteDelay = status.ByteWriteDelayUs;
+	}
+	printf("Timing values: FormatImageDelay %d, FormatRegionsPageDelay %d, PageWriteDelay %d.\n", FormatImageDelay, FormatRegionsPageDelay, PageWriteDelay);
+
+	if( resuming ) return StartWriting();
+	if( retry && !probed ) return parse_result ? AwaitImage( UPDATE_PROBE_FORMAT_IMAGE ) : StartProbe();
+
+	return SendFormatImage();
+}
+
+// Polls for the end of parsing, then carries on with the probe or the
+// regions. The image must have the layout the update started with.
+uint32_t CirqueUpdateSession::AwaitImage( UpdateState next_state )
+{
+	parse_next = next_state;
+	state = UPDATE_PARSE;
+	BeginSpan( phase_span, "Wait for parsing" );
+	return ImageParsed();
+}
+
+uint32_t CirqueUpdateSession::ImageParsed()
+{
+	int result = parse_result->load();
+	if( result == HEX_IN_PROGRESS ) return PARSE_POLL_US;
+	EndSpan( phase_span );
+	parse_result = NULL;
+	if( result != HEX_SUCCESS ) return ParseFailed( "failed to parse" );
+
+	const CirqueImageLayout* expected = layout;
+	layout = NULL;
+	if( hfp.Image.Count() != expected->RegionCount || EntryPoint() != expected->EntryPoint )
+		return ParseFailed( "doesn't have the layout the update started with" );
+
+	if( parse_next == UPDATE_PROBE_FORMAT_IMAGE ) return StartProbe();
+	region = 0;
+	return FormatRegion();
+}
+
+// The device is already in bootloader mode when a streamed file turns out
+// to be bad, and may have been erased too.
+uint32_t CirqueUpdateSession::ParseFailed( const char* reason )
+{
+	printf("%s %s.\n", hex_file_path.c_str(), reason);
+	if( erased )
+		printf("The device was left in bootloader mode with its image erased. Update it again with a valid firmware file.\n");
+	else
+		printf("The device was left in bootloader mode with its image unchanged.\n");
+	return Finish( BL_FAILURE );
+}
+
+uint32_t CirqueUpdateSession::EntryPoint()
+{
+	if( layout ) return layout->EntryPoint;
+	if( hfp.Image[0].Size < 8 ) return 0;
+	const uint8_t* data = hfp.Image.View( 0, 4, 4 );
+	if( data == NULL ) return 0;
+	return data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( data[3] << 24 );
+}
+
+// A device that didn't answer the sanity check is in bootloader mode and
+// its byte order is unknown. Rather than writing the whole image and
+// retrying with the other byte order when Validate fails, write the start
+// of region 0 as a one-region image with the little-endian checksum and
+// validate its header. A checksum mismatch means the device is big-endian.
+// The real FormatImage erases the probe again.
+uint32_t CirqueUpdateSession::StartProbe()
+{
+	CirqueImageRegion first_region = hfp.Image[0];
+	probed = true;
+	probe_length = ( first_region.Size < ENDIAN_PROBE_LENGTH ) ? ( first_region.Size & ~1u ) : ENDIAN_PROBE_LENGTH;
+
+	const uint8_t* data = hfp.Image.View( 0, 0, probe_length );
+	if( probe_length == 0 || data == NULL || CirqueBootloaderCollection::Fletcher_32( data, probe_length, 0 ) == CirqueBootloaderCollection::Fletcher_32( data, probe_length, 1 ) )
+	{
+		printf("Endianness probe skipped, the probe data has the same checksum in both byte orders.\n");
+		return SendFormatImage();
+	}
+
+	BeginSpan( phase_span, "Endianness probe" );
+	bl.IS_BIG_ENDIAN = 0;
+	erased = true;
+	int retval = bl.FormatImage( 1, EntryPoint(), ( status.Version >= 0x09 ) ? 0xFF : 0x2C, ( status.Version >= 0x09 ) ? 0xFFFF : 0x0020 );
+	if( retval != BL_SUCCESS ) return EndProbe( "FormatImage failed" );
+
+	state = UPDATE_PROBE_FORMAT_IMAGE;
+	waiting = true;
+	return bl.StartWait( FormatImageDelay * 1000 );
+}
+
+uint32_t CirqueUpdateSession::ProbeImageFormatted()
+{
+	if( !Completed() ) return EndProbe( "FormatImage failed" );
+
+	CirqueImageRegion first_region = hfp.Image[0];
+	const uint8_t* data = hfp.Image.View( 0, 0, probe_length );
+	if( data == NULL ) return EndProbe( "FormatRegion failed" );
+	int retval = bl.FormatRegion( 0, first_region.Address, data, probe_length );
+	if( retval != BL_SUCCESS ) return EndProbe( "FormatRegion failed" );
+
+	state = UPDATE_PROBE_FORMAT_REGION;
+	waiting = true;
+	return bl.StartWait( FormatRegionsPageDelay * 1000 );
+}
+
+uint32_t CirqueUpdateSession::ProbeRegionFormatted()
+{
+	if( !Completed() ) return EndProbe( "FormatRegion failed" );
+
+	CirqueImageRegion first_region = hfp.Image[0];
+	const uint8_t* data = hfp.Image.View( 0, 0, probe_length );
+	if( data == NULL ) return EndProbe( "WriteData failed" );
+	int retval = bl.WriteData( first_region.Address, data, probe_length );
+	if( retval != BL_SUCCESS ) return EndProbe( "WriteData failed" );
+
+	state = UPDATE_PROBE_WRITE;
+	waiting = true;
+	return bl.StartWait( ( PageWriteDelay * probe_length > 1000 ) ? PageWriteDelay * probe_length : 1000 );
+}
+
+uint32_t CirqueUpdateSession::ProbeWritten()
+{
+	if( !Completed() ) return EndProbe( "WriteData failed" );
+
+	bl.Flush();
+	state = UPDATE_PROBE_FLUSH;
+	waiting = true;
+	return bl.StartWait( FlushDelay * 1000 );
+}
+
+uint32_t CirqueUpdateSession::ProbeFlushed()
+{
+	if( !Completed() ) return EndProbe( "Flush failed" );
+
+	bl.Validate( Headers );
+
+	state = UPDATE_PROBE_VALIDATE;
+	waiting = true;
+	return bl.StartWait( FlushDelay * 1000 );
+}
+
+uint32_t CirqueUpdateSession::ProbeValidated()
+{
+	if( wait_result != BL_SUCCESS ) return EndProbe( "Validate failed" );
+
+	if( status.LastError == NV_err_none )
+		bl.IS_BIG_ENDIAN = 0;
+	else if( status.LastError == NV_err_chksum_mismatch )
+		bl.IS_BIG_ENDIAN = 1;
+	else
+		return EndProbe( "Validate failed" );
+
+	printf("Endianness probe: the device is %s-endian.\n", bl.IS_BIG_ENDIAN ? "big" : "little");
+	retry = 0;
+	return EndProbe( NULL );
+}
+
+// The probe didn't work out. Carry on little-endian and keep the retry.
+// Either way, an error the probe left behind is cleared with a reset
+// before the real FormatImage, which would fail on it otherwise.
+uint32_t CirqueUpdateSession::EndProbe( const char* reason )
+{
+	if( reason )
+	{
+		printf("Endianness probe inconclusive: %s with error %d.\n", reason, status.LastError);
+		bl.IS_BIG_ENDIAN = 0;
+	}
+	if( wait_result == BL_SUCCESS && status.LastError != NV_err_none )
+	{
+		int retval = bl.Reset();
+		return Issue( retval, ResetDelay * 1000, UPDATE_PROBE_CLEAR_ERROR, 1 );
+	}
+	EndSpan( phase_span );
+	return SendFormatImage();
+}
+
+uint32_t CirqueUpdateSession::ProbeErrorCleared()
+{
+	EndSpan( phase_span );
+	if( !Completed() )
+	{
+		printf("GetStatus after clearing the probe error failed with error %d.\n", status.LastError);
+		return Finish( ( wait_result != BL_SUCCESS ) ? wait_result : BL_FAILURE );
+	}
+	return SendFormatImage();
+}
+
+uint32_t CirqueUpdateSession::SendFormatImage()
+{
+	// Don't erase the device for a file that has already failed to parse.
+	if( parse_result && parse_result->load() != HEX_IN_PROGRESS && parse_result->load() != HEX_SUCCESS ) return ParseFailed( "failed to parse" );
+
+	// Format image.
+	uint32_t EntryPoint = this->EntryPoint();
+
+	uint8_t TargetI2CAddress = 0x2C;
+	uint16_t TargetHIDDescAddr = 0x0020;
+	if( status.Version >= 0x09)
+	{
+		TargetI2CAddress = 0xFF;
+		TargetHIDDescAddr = 0xFFFF;
+	}
+
+	uint8_t regions = (uint8_t)( layout ? layout->RegionCount : hfp.Image.Count() );
+	printf("FormatImage called with size %d, entry point 0x%08X, I2C address 0x%02X, HID descriptor address 0x%04X.\n", regions, EntryPoint, TargetI2CAddress, TargetHIDDescAddr );
+	BeginSpan( phase_span, "FormatImage" );
+	erased = true;
+	int retval = bl.FormatImage( regions, EntryPoint, TargetI2CAddress, TargetHIDDescAddr );
+	printf("FormatImage returned %d.\n", retval);
+	return Issue( retval, FormatImageDelay * 1000, UPDATE_FORMAT_IMAGE );
+}
+
+uint32_t CirqueUpdateSession::ImageFormatted()
+{
+	EndSpan( phase_span );
+	if( !Completed() )
+	{
+		printf("GetStatus after formatting image failed with error %d.\n", status.LastError);
+		return Finish( BL_FAILURE );
+	}
+
+	if( parse_result ) return AwaitImage( UPDATE_FORMAT_REGION );
+	region = 0;
+	return FormatRegion();
+}
+
+uint32_t CirqueUpdateSession::FormatRegion()
+{
+	// Format regions.
+	CirqueImageRegion image_region = hfp.Image[region];
+	BeginSpan( phase_span, "FormatRegion " + to_string( region ) );
+	int retval = bl.FormatRegion( (uint8_t)region, image_region );
+	printf("FormatRegion returned %d.\n", retval);
+	return Issue( retval, FormatRegionsPageDelay * 1000 * ((image_region.Size / 1024) + 1), UPDATE_FORMAT_REGION );
+}
+
+uint32_t CirqueUpdateSession::RegionFormatted()
+{
+	EndSpan( phase_span );
+	if( !Completed() )
+	{
+		printf("GetStatus failed with error %d.\n", status.LastError);
+		return Finish( BL_FAILURE );
+	}
+	printf("GetStatus returned %d.\n", BL_SUCCESS);
+
+	if( ++region < hfp.Image.Count() ) return FormatRegion();
+
+	if( journal ) journal->Start( bl.IS_BIG_ENDIAN );
+	return StartWriting();
+}
+
+uint32_t CirqueUpdateSession::StartWriting()
+{
+	// Write data.
+	delete plan;
+	plan = new CirqueWritePlanner( bl.MaxWritePayload(), ( status.Version >= 0x08 ) ? status.AtomicWriteSize : 0 );
+	plan->Plan( hfp.Image, options.Differential );
+	plan->Print();
+
+	total_bytes = 0;
+	write_start = CirqueMonotonicUs();
+	pacer.NsPerByte = PageWriteDelay * 1000;
+	pacer.MinNsPerByte = 0;
+
+	region = 0;
+	return StartRegion();
+}
+
+uint32_t CirqueUpdateSession::StartRegion()
+{
+	if( region >= hfp.Image.Count() ) return FinishWriting();
+
+	plan->RegionChunks( (uint8_t)region, first, count );
+	while( resuming && count > 0 && journal->IsWritten( plan->chunks[first].Region, plan->chunks[first].Offset ) )
+	{
+		first++;
+		count--;
+	}
+	printf("Writing %d bytes of data.\n", hfp.Image[region].Size);
+	BeginSpan( region_span, "WriteData region " + to_string( region ) );
+
+	next = 0;
+	verified = 0;
+	pending = 0;
+	retries = 0;
+	return WriteNext();
+}
+
+// Sequential writes check the status after every report. Pipelined writes
+// only pace the reports by an estimate of the device write time, and check
+// the status once per window of reports (or once per region if the window
+// is 0). If the check reports an error, writing restarts from the end of
+// the last good window.
+//
+// The pace starts at the advertised byte write delay. It shrinks by 1/8
+// whenever the device is already idle at a check. After an error it grows
+// by 1/4 and never shrinks below that value again.
+uint32_t CirqueUpdateSession::WriteNext()
+{
+	if( verified >= count ) return RegionWritten();
+
+	CirqueWriteChunk& chunk = plan->chunks[first + next];
+	if( options.PipelinedWrites && pending == 0 ) BeginSpan( burst_span, "WriteData burst" );
+	// A compressed image is decompressed here, a block at a time.
+	const uint8_t* data = hfp.Image.View( region, chunk.Offset, chunk.Length );
+	if( data == NULL ) return Finish( BL_FAILURE );
+	int retval = bl.WriteData( chunk.Address, data, chunk.Length );
+	if( retval != BL_SUCCESS ) return Finish( retval );
+	next++;
+
+	if( !options.PipelinedWrites )
+		return Issue( retval, ( PageWriteDelay * chunk.Length > 1000 ) ? PageWriteDelay * chunk.Length : 1000, UPDATE_WRITE );
+
+	pending++;
+	state = UPDATE_WRITE_PACE;
+	return (uint64_t)pacer.NsPerByte * chunk.Length / 1000;
+}
+
+uint32_t CirqueUpdateSession::Written()
+{
+	if( !Completed() )
+	{
+		printf("GetStatus while writing data failed with error %d.\n", status.LastError);
+		return Finish( BL_FAILURE );
+	}
+
+	CirqueWriteChunk& chunk = plan->chunks[first + next - 1];
+	if( journal ) journal->Verified( chunk.Region, chunk.Offset + chunk.Length );
+	verified = next;
+	return WriteNext();
+}
+
+uint32_t CirqueUpdateSession::Paced()
+{
+	if( next < count && ( options.WriteWindow == 0 || pending < options.WriteWindow ) ) return WriteNext();
+
+	// Verify the window.
+	uint32_t PayloadSize = plan->chunks[first + next - 1].Length;
+	int retval = bl.GetStatus( status );
+	window_idle = ( retval == BL_SUCCESS && !status.bBusy );
+	if( retval == BL_SUCCESS && status.LastError == NV_err_none && status.bBusy )
+		return Issue( retval, PageWriteDelay * PayloadSize + 1000, UPDATE_WRITE_WINDOW );
+
+	wait_result = retval;
+	return WindowChecked();
+}
+
+uint32_t CirqueUpdateSession::WindowChecked()
+{
+	EndSpan( burst_span );
+	if( wait_result != BL_SUCCESS )
+	{
+		printf("GetStatus while writing data failed with %d.\n", wait_result);
+		return Finish( wait_result );
+	}
+
+	if( status.LastError != NV_err_none )
+	{
+		if( ++retries > PIPELINE_MAX_RETRIES )
+		{
+			printf("GetStatus while writing data failed with error %d.\n", status.LastError);
+			return Finish( BL_FAILURE );
+		}
+		printf("Write error %d, rewriting from 0x%08X.\n", status.LastError, plan->chunks[first + verified].Address);
+		pacer.NsPerByte += pacer.NsPerByte / 4 + 1;
+		pacer.MinNsPerByte = pacer.NsPerByte;
+
+		// Let the device settle before clearing the error, it drops
+		// commands while it is busy.
+		if( status.bBusy )
+			return Issue( BL_SUCCESS, PageWriteDelay * plan->chunks[first + next - 1].Length + 1000, UPDATE_WRITE_SETTLE );
+		return ClearWriteError();
+	}
+
+	if( window_idle && pacer.NsPerByte - pacer.NsPerByte / 8 >= pacer.MinNsPerByte ) pacer.NsPerByte -= pacer.NsPerByte / 8;
+	verified = next;
+	pending = 0;
+	retries = 0;
+
+	CirqueWriteChunk& chunk = plan->chunks[first + verified - 1];
+	if( journal ) journal->Verified( chunk.Region, chunk.Offset + chunk.Length );
+	return WriteNext();
+}
+
+// The device keeps reporting an error until it is reset. A bootloader
+// without a valid image stays in bootloader mode and keeps the formatted
+// regions, so writing can carry on after the last good window.
+uint32_t CirqueUpdateSession::ClearWriteError()
+{
+	int retval = bl.Reset();
+	return Issue( retval, ResetDelay * 1000, UPDATE_WRITE_CLEAR_ERROR, 1 );
+}
+
+uint32_t CirqueUpdateSession::Rewind()
+{
+	if( !Completed() )
+	{
+		printf("GetStatus after clearing the write error failed with error %d.\n", status.LastError);
+		return Finish( ( wait_result != BL_SUCCESS ) ? wait_result : BL_FAILURE );
+	}
+
+	next = verified;
+	pending = 0;
+	return WriteNext();
+}
+
+uint32_t CirqueUpdateSession::RegionWritten()
+{
+	EndSpan( region_span );
+	if( journal )
+	{
+		journal->Verified( (uint8_t)region, hfp.Image[region].Size );
+		journal->Save();
+	}
+
+	for( size_t c = first; c < first + count; c++ ) total_bytes += plan->chunks[c].Length;
+
+	region++;
+	return StartRegion();
+}
+
+uint32_t CirqueUpdateSession::FinishWriting()
+{
+	uint64_t WriteTime = CirqueMonotonicUs() - write_start;
+	printf("Wrote %d bytes in %d ms (%d bytes/s, %s).\n", total_bytes, (int)(WriteTime / 1000),
+		WriteTime ? (int)((uint64_t)total_bytes * 1000000 / WriteTime) : 0,
+		options.PipelinedWrites ? "pipelined" : "sequential");
+
+	// Flush.
+	BeginSpan( phase_span, "Flush" );
+	bl.Flush();
+	return Issue( BL_SUCCESS, FlushDelay * 1000, UPDATE_FLUSH );
+}
+
+uint32_t CirqueUpdateSession::Flushed()
+{
+	EndSpan( phase_span );
+	if( !Completed() )
+	{
+		printf("GetStatus after flushing failed with error %d.\n", status.LastError);
+		return Finish( BL_FAILURE );
+	}
+	printf("Flush successful.\n");
+
+	// Validate.
+	BeginSpan( phase_span, "Validate" );
+	bl.Validate( EntireImage );
+	return Issue( BL_SUCCESS, FlushDelay * 1000, UPDATE_VALIDATE );
+}
+
+uint32_t CirqueUpdateSession::Validated()
+{
+	EndSpan( phase_span );
+	if( !Completed() )
+	{
+		printf("GetStatus after image validation failed with error %d.\n", status.LastError);
+		// If we failed with checksum mismatch, it's possible we used the wrong endianness.
+		// Let's change the endianness and retry.
+		if( retry && status.LastError == NV_err_chksum_mismatch )
+		{
+			printf("Restarting the update sequence.\n");
+			retry = 0;
+			bl.IS_BIG_ENDIAN = !bl.IS_BIG_ENDIAN;
+			state = UPDATE_STATUS;
+			return 0;
+		}
+		// The resumed image didn't check out. Start over.
+		if( resuming )
+		{
+			printf("Resumed image failed validation, restarting the update sequence.\n");
+			state = UPDATE_STATUS;
+			return 0;
+		}
+		if( journal ) journal->Remove();
+		return Finish( BL_FAILURE );
+	}
+	printf("Validation successful.\n");
+	if( journal ) journal->Remove();
+
+	// Reset.
+	BeginSpan( phase_span, "Reset" );
+	int retval = bl.Reset();
+	printf("Reset returned %d.\n", retval);
+	return Issue( retval, ResetDelay * 1000, UPDATE_RESET, 0 );
+}
+
+uint32_t CirqueUpdateSession::ResetDone()
+{
+	EndSpan( phase_span );
+	// Check status.
+	if( wait_result == BL_MODE_TIMEOUT )
+	{
+		printf("The device didn't start the new firmware after the reset.\n");
+		return Finish( wait_result );
+	}
+	if( !Completed() )
+	{
+		printf("GetStatus after reset failed with error %d.\n", status.LastError);
+		return Finish( BL_FAILURE );
+	}
+	printf("Firmware update successful.\n");
+
+	return Finish( BL_SUCCESS );
+}
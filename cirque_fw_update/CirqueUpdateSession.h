@@ -0,0 +1,225 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_UPDATE_SESSION_H__
+#define __CIRQUE_UPDATE_SESSION_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include "CirqueBootloaderCollection.h"
+#include "CirqueHexFileParser.h"
+#include "CirqueWritePlanner.h"
+#include "CirqueUpdateJournal.h"
+#include "CirqueImageCache.h"
+
+using namespace std;
+
+// Granularity of the differential comparison.
+#define DIFF_PAGE_SIZE 1024
+// Consecutive failed windows before a pipelined write gives up.
+#define PIPELINE_MAX_RETRIES 3
+
+// Bytes of region 0 used to find the byte order of a device in bootloader mode.
+#define ENDIAN_PROBE_LENGTH 256
+
+// How often a session that needs the image checks whether parsing is done.
+#define PARSE_POLL_US 1000
+
+// Formats of the command statistics printed after an update.
+#define STATS_NONE (0)
+#define STATS_TEXT (1)
+#define STATS_JSON (2)
+
+struct UpdateOptions
+{
+	bool PipelinedWrites = false;
+	uint32_t WriteWindow = 8;
+	bool Differential = false;
+	bool AllDevices = false;
+	bool SkipIfCurrent = false;
+	string JournalPath;
+	int StatsFormat = STATS_NONE;
+	string StatsPath;
+	string TracePath;
+	CirqueTraceLog* Trace = NULL;
+	unsigned ParseThreads = 0;
+	uint32_t MaxGapFill = 0;
+	int ByteOrder = IMAGE_BYTE_ORDER_UNKNOWN;
+	bool CompressBin = false;
+	bool StreamParse = false;
+	string CacheDir;
+	uint64_t CacheBytes = IMAGE_CACHE_DEFAULT_BYTES;
+};
+
+// Time allowed per byte between pipelined payloads.
+struct WritePacer
+{
+	uint32_t NsPerByte;
+	uint32_t MinNsPerByte;
+};
+
+enum UpdateState
+{
+	UPDATE_START,
+	UPDATE_STATUS,
+	UPDATE_CLEAR_ERROR,
+	UPDATE_INVOKE,
+	UPDATE_PARSE,
+	UPDATE_PROBE_FORMAT_IMAGE,
+	UPDATE_PROBE_FORMAT_REGION,
+	UPDATE_PROBE_WRITE,
+	UPDATE_PROBE_FLUSH,
+	UPDATE_PROBE_VALIDATE,
+	UPDATE_PROBE_CLEAR_ERROR,
+	UPDATE_FORMAT_IMAGE,
+	UPDATE_FORMAT_REGION,
+	UPDATE_WRITE,
+	UPDATE_WRITE_PACE,
+	UPDATE_WRITE_WINDOW,
+	UPDATE_WRITE_SETTLE,
+	UPDATE_WRITE_CLEAR_ERROR,
+	UPDATE_FLUSH,
+	UPDATE_VALIDATE,
+	UPDATE_RESET,
+	UPDATE_DONE,
+	UPDATE_FAILED
+};
+
+// Updates the firmware of one device. The update sequence (status, invoke,
+// format image, format regions, write, flush, validate, reset) is a state
+// machine that never sleeps: Step does as much as it can and returns how
+// long to wait before it is called again, so one thread can drive many
+// devices. The parsed image is only read.
+class CirqueUpdateSession
+{
+	private:
+	CirqueBootloaderCollection bl;
+	CirqueHexFileParser& hfp;
+	string device_path;
+	string hex_file_path;
+	UpdateOptions options;
+	CirqueUpdateJournal update_journal;
+	CirqueUpdateJournal* journal;
+	int journal_state = JOURNAL_NONE;
+
+	UpdateState state = UPDATE_START;
+	bool waiting = false;
+	int wait_result = BL_SUCCESS;
+	CirqueBootloaderStatus status;
+	int retry = 0;
+	bool resuming = false;
+	bool probed = false;
+	uint32_t probe_length = 0;
+	// Set once a FormatImage, the probe's included, may have erased the device.
+	bool erased = false;
+
+	// While the firmware file is still being parsed, see StreamImage.
+	const CirqueImageLayout* layout = NULL;
+	const atomic<int>* parse_result = NULL;
+	UpdateState parse_next = UPDATE_FORMAT_IMAGE;
+
+	uint32_t ResetDelay = 100;
+	uint32_t FormatImageDelay = 100;
+	uint32_t FormatRegionsPageDelay = 50;
+	uint32_t PageWriteDelay = 10;
+	uint32_t FlushDelay = 10;
+
+	// Write progress within the current region, in chunks of the plan.
+	CirqueWritePlanner* plan = NULL;
+	size_t region = 0;
+	size_t first = 0, count = 0, next = 0, verified = 0;
+	uint32_t pending = 0, retries = 0;
+	bool window_idle = false;
+	WritePacer pacer;
+	uint32_t total_bytes = 0;
+	uint64_t write_start = 0;
+	uint64_t start_time = 0;
+
+	// Open spans of the trace log, -1 if none.
+	int update_span = -1;
+	int phase_span = -1;
+	int region_span = -1;
+	int burst_span = -1;
+
+	void BeginSpan( int& span, const string& name );
+	void EndSpan( int& span );
+
+	int CountDifferingPages();
+
+	uint32_t Issue( int retval, uint32_t DelayUs, UpdateState next_state, int mode = -1 );
+	uint32_t Finish( int retval );
+	bool Completed() { return wait_result == BL_SUCCESS && status.LastError == NV_err_none; }
+
+	uint32_t Advance();
+	uint32_t Start();
+	uint32_t ReadStatus();
+	uint32_t ErrorCleared();
+	uint32_t EnterBootloader();
+	uint32_t Invoked();
+	uint32_t AwaitImage( UpdateState next_state );
+	uint32_t ImageParsed();
+	uint32_t ParseFailed( const char* reason );
+	uint32_t EntryPoint();
+	uint32_t StartProbe();
+	uint32_t ProbeImageFormatted();
+	uint32_t ProbeRegionFormatted();
+	uint32_t ProbeWritten();
+	uint32_t ProbeFlushed();
+	uint32_t ProbeValidated();
+	uint32_t EndProbe( const char* reason );
+	uint32_t ProbeErrorCleared();
+	uint32_t FormatImage();
+	uint32_t SendFormatImage();
+	uint32_t ImageFormatted();
+	uint32_t FormatRegion();
+	uint32_t RegionFormatted();
+	uint32_t StartWriting();
+	uint32_t StartRegion();
+	uint32_t WriteNext();
+	uint32_t Written();
+	uint32_t Paced();
+	uint32_t WindowChecked();
+	uint32_t ClearWriteError();
+	uint32_t Rewind();
+	uint32_t RegionWritten();
+	uint32_t FinishWriting();
+	uint32_t Flushed();
+	uint32_t Validated();
+	uint32_t ResetDone();
+
+	public:
+	int Result = BL_FAILURE;
+	uint64_t ElapsedUs = 0;
+
+	CirqueUpdateSession( string& hid_device_path, CirqueHexFileParser& hex_file, string& hex_file_path, UpdateOptions& update_options );
+	~CirqueUpdateSession();
+
+	// Starts the update before the image is parsed. The layout stands in
+	// for the image until ParseResult leaves HEX_IN_PROGRESS, which the
+	// session waits for before it needs the data. No journal or
+	// differential update, which read the image up front.
+	void StreamImage( const CirqueImageLayout* Layout, const atomic<int>* ParseResult ) { layout = Layout; parse_result = ParseResult; }
+
+	CirqueCommandStats& Stats() { return bl.Stats; }
+	void SetTrace( CirqueTraceLog* trace, int track ) { bl.Trace = trace; bl.TraceTrack = track; }
+	bool IsFinished() { return state == UPDATE_DONE || state == UPDATE_FAILED; }
+	// Runs the update up to the next wait. Returns the time in microseconds
+	// until the next call, or -1 once the update has finished.
+	int64_t Step();
+};
+
+#endif //__CIRQUE_UPDATE_SESSION_H__
@@ -0,0 +1,111 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <cstdio>
+#include "CirqueWritePlanner.h"
+
+CirqueWritePlanner::CirqueWritePlanner( uint32_t PayloadCapacity, uint8_t AtomicWriteSize )
+{
+	// Payloads must be even. Without an advertised atomic write size, keep
+	// them a multiple of 4.
+	capacity = PayloadCapacity & ~1u;
+	atomic_size = ( AtomicWriteSize >= 2 ) ? ( AtomicWriteSize & ~1u ) : 4;
+
+	chunk_size = ( capacity / atomic_size ) * atomic_size;
+	if( chunk_size == 0 )
+	{
+		// Atomic units larger than a report can't be written whole.
+		chunk_size = capacity;
+		atomic_size = 2;
+	}
+}
+
+static bool IsErased( const uint8_t *data, uint32_t length )
+{
+	for( uint32_t i = 0; i < length; i++ )
+	{
+		if( data[i] != 0xFF ) return false;
+	}
+	return true;
+}
+
+void CirqueWritePlanner::Plan( const CirqueFirmwareImage& image, bool SkipErased )
+{
+	chunks.clear();
+	skipped = 0;
+
+	for( size_t i = 0; i < image.Count(); i++ )
+	{
+		CirqueImageRegion region = image[i];
+		uint32_t base = region.Address;
+		uint32_t size = region.Size;
+		uint32_t offset = 0;
+
+		while( offset < size )
+		{
+			// End on an atomic boundary unless the region ends first.
+			uint32_t address = base + offset;
+			uint32_t end = ( ( address + chunk_size ) / atomic_size ) * atomic_size;
+			uint32_t length = ( end - address < size - offset ) ? end - address : size - offset;
+
+			const uint8_t *data = SkipErased ? image.View( i, offset, length ) : NULL;
+			if( data && IsErased( data, length ) )
+			{
+				skipped++;
+			}
+			else
+			{
+				CirqueWriteChunk chunk = { (uint8_t)i, address, offset, length };
+				chunks.push_back( chunk );
+			}
+			offset += length;
+		}
+	}
+}
+
+void CirqueWritePlanner::RegionChunks( uint8_t Region, size_t& First, size_t& Count )
+{
+	First = 0;
+	Count = 0;
+	while( First < chunks.size() && chunks[First].Region != Region )
+		First++;
+	while( First + Count < chunks.size() && chunks[First + Count].Region == Region )
+		Count++;
+}
+
+void CirqueWritePlanner::Print()
+{
+	uint32_t full = 0;
+	for( size_t i = 0; i < chunks.size(); i++ )
+	{
+		if( chunks[i].Length == chunk_size ) full++;
+	}
+
+	printf( "Write plan: %d reports, %d bytes per report (capacity %d, atomic write size %d), %d partial.\n",
+		(int)chunks.size(), chunk_size, capacity, atomic_size, (int)( chunks.size() - full ) );
+	if( skipped ) printf( "  %d reports of erased data skipped.\n", skipped );
+
+	size_t first = 0;
+	while( first < chunks.size() )
+	{
+		size_t count = 0;
+		uint32_t bytes = 0;
+		while( first + count < chunks.size() && chunks[first + count].Region == chunks[first].Region )
+			bytes += chunks[first + count++].Length;
+		printf( "  Region %d: 0x%08X, %d bytes in %d reports.\n", chunks[first].Region, chunks[first].Address, bytes, (int)count );
+		first += count;
+	}
+}
@@ -0,0 +1,57 @@
+/*
+Copyright 2019 Cirque Corporation
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef __CIRQUE_WRITE_PLANNER_H__
+#define __CIRQUE_WRITE_PLANNER_H__
+
+#include <vector>
+#include "CirqueFirmwareImage.h"
+
+using namespace std;
+
+// One WriteData report: Length bytes of region Region starting at byte
+// Offset of the region, written to device address Address.
+struct CirqueWriteChunk
+{
+	uint8_t Region;
+	uint32_t Address;
+	uint32_t Offset;
+	uint32_t Length;
+};
+
+// Splits the image regions into WriteData reports. Reports are as large as
+// the report capacity allows, rounded down to a multiple of the device's
+// atomic write size, and start on atomic write boundaries so the device
+// never has to read-modify-write a partially covered unit. Reports that
+// would only write 0xFF can be left out, since formatting a region erases it.
+class CirqueWritePlanner
+{
+private:
+	uint32_t capacity;
+	uint32_t atomic_size;
+	uint32_t chunk_size;
+	uint32_t skipped = 0;
+
+public:
+	vector<CirqueWriteChunk> chunks;
+
+	CirqueWritePlanner( uint32_t PayloadCapacity, uint8_t AtomicWriteSize );
+	void Plan( const CirqueFirmwareImage& image, bool SkipErased = false );
+	void RegionChunks( uint8_t Region, size_t& First, size_t& Count );
+	void Print();
+};
+
+#endif //__CIRQUE_WRITE_PLANNER_H__